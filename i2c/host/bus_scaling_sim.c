@@ -0,0 +1,224 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// bus_scaling_sim.c
+// Synthetic model of running the driver as one PD for every bus against one
+// PD per bus (see i2c_per_bus.system). No driver or server code runs here: the
+// wire and driver times below are parameters, not measurements, so this only
+// shows how the two layouts scale. e2e_bench runs the real stack. Each bus alternates between the list
+// processor running a transaction, which takes wire time but no CPU, and the
+// driver completing it and starting the next, which takes CPU time. In shared
+// mode a single thread services all the buses, as the single driver PD does.
+// In per-bus mode every bus gets a thread of its own, pinned to its own core
+// where possible. Reports aggregate transactions per second for 1 to 4 buses,
+// and the p99 delay between a transaction finishing and the driver getting to
+// it.
+//
+// Usage: bus_scaling_sim [-w wire_ns] [-o work_ns] [-t ms] [-c]
+//   -w   bus time per transaction (default 30000, a short read at 1 MHz)
+//   -o   driver CPU time per transaction (default 15000)
+//   -t   length of each run in ms (default 500)
+//   -c   print CSV instead of a table
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_BUSES 4
+
+// Service delays kept per bus for the percentile
+#define MAX_SAMPLES (1 << 20)
+
+typedef struct {
+    uint64_t done_at;       // When the transaction on the bus finishes
+    unsigned long txns;     // Transactions completed
+    uint64_t *delays;       // Completion-to-service delay of each transaction
+    unsigned long ndelay;
+} sim_bus_t;
+
+typedef struct {
+    sim_bus_t *buses;       // Buses serviced by this driver thread
+    int nbuses;
+    int cpu;
+} sim_driver_t;
+
+static int ncpus;
+static uint64_t wire_ns = 30000;
+static uint64_t work_ns = 15000;
+static uint64_t run_ns = 500000000ULL;
+static uint64_t deadline;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+    if (ncpus < 2) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % ncpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Driver work is modelled as spinning, so it really does occupy the core
+static inline void spin(uint64_t ns)
+{
+    uint64_t end = now_ns() + ns;
+    while (now_ns() < end);
+}
+
+static void *driver(void *arg)
+{
+    sim_driver_t *d = arg;
+    pin(d->cpu);
+
+    uint64_t t = now_ns();
+    for (int b = 0; b < d->nbuses; b++) {
+        d->buses[b].done_at = t + wire_ns;
+    }
+
+    // Service whichever buses have finished, the way the driver handles each
+    // IRQ in turn. A bus that finishes while another is being serviced waits.
+    while ((t = now_ns()) < deadline) {
+        int idle = 1;
+        for (int b = 0; b < d->nbuses; b++) {
+            sim_bus_t *bus = &d->buses[b];
+            if (t < bus->done_at) {
+                continue;
+            }
+            idle = 0;
+            if (bus->ndelay < MAX_SAMPLES) {
+                bus->delays[bus->ndelay++] = t - bus->done_at;
+            }
+            spin(work_ns);
+            bus->txns++;
+            t = now_ns();
+            bus->done_at = t + wire_ns;
+        }
+        if (idle && ncpus < 2) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Run nbuses buses, serviced by one thread if per_bus is 0 or by a thread each
+ * if it is 1.
+ * @return aggregate transactions per second.
+ */
+static double run(int nbuses, int per_bus, double base, int csv)
+{
+    sim_bus_t buses[NUM_BUSES] = {0};
+    sim_driver_t drivers[NUM_BUSES];
+    pthread_t threads[NUM_BUSES];
+    for (int b = 0; b < nbuses; b++) {
+        buses[b].delays = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    }
+
+    int nthreads = per_bus ? nbuses : 1;
+    for (int i = 0; i < nthreads; i++) {
+        drivers[i] = (sim_driver_t) {
+            .buses = per_bus ? &buses[i] : buses,
+            .nbuses = per_bus ? 1 : nbuses,
+            .cpu = i,
+        };
+    }
+    uint64_t start = now_ns();
+    deadline = start + run_ns;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i], NULL, driver, &drivers[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    unsigned long txns = 0, ndelay = 0;
+    for (int b = 0; b < nbuses; b++) {
+        txns += buses[b].txns;
+        ndelay += buses[b].ndelay;
+    }
+    uint64_t *delays = malloc((ndelay + 1) * sizeof(uint64_t));
+    unsigned long n = 0;
+    for (int b = 0; b < nbuses; b++) {
+        memcpy(delays + n, buses[b].delays, buses[b].ndelay * sizeof(uint64_t));
+        n += buses[b].ndelay;
+        free(buses[b].delays);
+    }
+    qsort(delays, n, sizeof(uint64_t), cmp_u64);
+    uint64_t p99 = n ? delays[(n * 99) / 100] : 0;
+    free(delays);
+
+    double rate = txns / elapsed;
+    const char *mode = per_bus ? "per-bus" : "shared";
+    if (!base) {
+        base = rate;
+    }
+    if (csv) {
+        printf("%s,%d,%.0f,%.2f,%lu\n", mode, nbuses, rate, rate / base, (unsigned long)p99);
+    } else {
+        printf("%-8s %5d %14.0f %8.2f %12lu\n", mode, nbuses, rate, rate / base, (unsigned long)p99);
+    }
+    return rate;
+}
+
+int main(int argc, char **argv)
+{
+    int csv = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c")) {
+            csv = 1;
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            wire_ns = strtoull(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            work_ns = strtoull(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            run_ns = strtoull(argv[++i], NULL, 0) * 1000000ULL;
+        } else {
+            fprintf(stderr, "usage: %s [-w wire_ns] [-o work_ns] [-t ms] [-c]\n", argv[0]);
+            return 1;
+        }
+    }
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (csv) {
+        printf("mode,buses,txns_per_sec,speedup,p99_service_delay_ns\n");
+    } else {
+        printf("bus scaling: %lu ns on the wire, %lu ns of driver work per transaction, %d cpu(s)%s\n",
+               (unsigned long)wire_ns, (unsigned long)work_ns, ncpus,
+               ncpus < NUM_BUSES ? " - fewer cpus than buses, per-bus threads share cores" : "");
+        printf("%-8s %5s %14s %8s %12s\n", "mode", "buses", "txns/sec", "speedup", "p99 delay ns");
+    }
+    for (int per_bus = 0; per_bus < 2; per_bus++) {
+        double base = 0;
+        for (int n = 1; n <= NUM_BUSES; n++) {
+            double rate = run(n, per_bus, base, csv);
+            if (n == 1) {
+                base = rate;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// driver_harness.c
+// Runs the ODROID C4 driver on Linux against the register mock in oc4_host.c.
+// The harness plays both the server, queueing requests through the transport,
+// and the list processor, finishing each load the driver starts. It brings the
+// driver up with init, then pushes a write, a read, a NACK and a timeout
+// through dispatch, i2cLoadTokens and i2cirq, checking the registers the
+// driver programs and the returns it hands back, and that a START stays in the
+// same load as its address. Then checks that neither a
+// request reading more than a return buffer holds nor running out of return
+// buffers leaves the bus stuck, and that aborted request buffers are reused.
+// Exits non-zero on the first mismatch.
+//
+// Usage: driver_harness [-v]
+//   -v   keep the driver's debug output (discarded by default)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oc4-host.h"
+
+// The driver is included rather than linked, as i2c_driver.c does, so the
+// harness can reach its internals. Its printf is the sel4cp one, so the
+// harness reports on stdout with fprintf.
+#include "i2c-odroid-c4.c"
+
+#define BUS 2
+#define CLIENT 1
+#define ADDR 0x68
+
+static int failures;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            fprintf(stdout, "FAIL %s:%d: ", __func__, __LINE__); \
+            fprintf(stdout, __VA_ARGS__);                        \
+            fprintf(stdout, "\n");                               \
+            failures++;                                         \
+            return;                                             \
+        }                                                       \
+    } while (0)
+
+static unsigned long server_notifies;
+
+static void onNotify(sel4cp_channel ch)
+{
+    if (ch == SERVER_NOTIFY_ID) {
+        server_notifies++;
+    }
+}
+
+static inline uint32_t tokenAt(volatile oc4_host_if_t *regs, int idx)
+{
+    uint32_t list = idx < 8 ? regs->tk_list0 : regs->tk_list1;
+    return (list >> ((idx % 8) * 4)) & 0xF;
+}
+
+/**
+ * Stand in for the list processor running the load the driver started: count
+ * the bytes it reads and hand back the next ones from `data`.
+ * @param reading: Data direction, carried from load to load
+ * @param next: Index of the next byte of data to return
+ */
+static void runLoad(int bus, int *reading, const uint8_t *data, int *next)
+{
+    volatile oc4_host_if_t *regs = oc4HostIf(bus);
+    uint8_t rd[8];
+    int rd_cnt = 0;
+    for (int i = 0; i < 16; i++) {
+        uint32_t tk = tokenAt(regs, i);
+        if (tk == OC4_I2C_TK_END) {
+            break;
+        }
+        if (tk == OC4_I2C_TK_ADDRW) {
+            *reading = 0;
+        } else if (tk == OC4_I2C_TK_ADDRR) {
+            *reading = 1;
+        } else if (*reading && (tk == OC4_I2C_TK_DATA || tk == OC4_I2C_TK_DATA_END)) {
+            rd[rd_cnt++] = data[(*next)++];
+        }
+    }
+    oc4HostFinish(bus, rd, rd_cnt, -1);
+}
+
+static void queue(const uint8_t *tokens, size_t len)
+{
+    allocReqBuf(BUS, len, (uint8_t *)tokens, CLIENT, ADDR);
+    notified(SERVER_NOTIFY_ID);
+}
+
+static ret_buf_ptr_t takeReturn(size_t *sz)
+{
+    return popRetBuf(BUS, sz);
+}
+
+static void testInit(void)
+{
+    volatile uint32_t *gpio_mem = (void *)(gpio + GPIO_OFFSET);
+    volatile uint32_t *clk81 = (void *)(clk + I2C_CLK_OFFSET);
+    const i2c_ifDesc_t *desc = &i2c_ifDesc[BUS];
+
+    CHECK(*clk81 & I2C_CLK81_BIT, "clk81 gate not removed");
+    CHECK((gpio_mem[desc->pinmux_reg] & desc->pinmux_mask) == desc->pinmux,
+          "pinmux 0x%x", gpio_mem[desc->pinmux_reg]);
+    CHECK(i2c_bus[BUS].speed == 400000, "bus at %u Hz", i2c_bus[BUS].speed);
+    CHECK(((oc4HostIf(BUS)->ctl & REG_CTRL_CLKDIV_MASK) >> REG_CTRL_CLKDIV_SHIFT) == 152,
+          "clock divider 0x%x", oc4HostIf(BUS)->ctl);
+}
+
+static void testWrite(void)
+{
+    // 12 bytes of data need two loads
+    uint8_t req[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DATN(8), 0, 1, 2, 3, 4, 5, 6, 7,
+                      I2C_TK_DATN(4), 8, 9, 10, 11, I2C_TK_STOP, I2C_TK_END };
+    volatile oc4_host_if_t *regs = oc4HostIf(BUS);
+    queue(req, sizeof(req));
+
+    CHECK(regs->ctl & REG_CTRL_START, "first load not started");
+    CHECK((regs->addr & 0xFF) == ADDR << 1, "addr 0x%x", regs->addr);
+    CHECK(regs->wdata0 == 0x03020100 && regs->wdata1 == 0x07060504,
+          "wdata 0x%08x 0x%08x", regs->wdata0, regs->wdata1);
+
+    int loads = 0, reading = 0, next = 0;
+    while (regs->ctl & REG_CTRL_START) {
+        runLoad(BUS, &reading, NULL, &next);
+        notified(i2c_ifDesc[BUS].irq);
+        loads++;
+    }
+    CHECK(loads == 2, "%d loads", loads);
+
+    size_t sz;
+    ret_buf_ptr_t ret = takeReturn(&sz);
+    CHECK(ret, "no return");
+    CHECK(sz == RET_BUF_HDR_SZ && ret[RET_BUF_ERR] == I2C_ERR_OK && ret[RET_BUF_CLIENT] == CLIENT &&
+          ret[RET_BUF_ADDR] == ADDR, "return sz %zu err %u", sz, ret[RET_BUF_ERR]);
+    releaseRetBuf(BUS, ret);
+}
+
+static void testRead(void)
+{
+    // Register pointer write, then 10 bytes read back over two loads
+    uint8_t req[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DAT, 0x00,
+                      I2C_TK_START, I2C_TK_ADDRR, I2C_TK_DATN(8), I2C_TK_DAT, I2C_TK_DATA_END,
+                      I2C_TK_STOP, I2C_TK_END };
+    const uint8_t data[] = { 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19 };
+    volatile oc4_host_if_t *regs = oc4HostIf(BUS);
+    queue(req, sizeof(req));
+
+    int reading = 0, next = 0;
+    while (regs->ctl & REG_CTRL_START) {
+        runLoad(BUS, &reading, data, &next);
+        notified(i2c_ifDesc[BUS].irq);
+    }
+
+    size_t sz;
+    ret_buf_ptr_t ret = takeReturn(&sz);
+    CHECK(ret, "no return");
+    CHECK(sz == RET_BUF_HDR_SZ + sizeof(data) && ret[RET_BUF_ERR] == I2C_ERR_OK,
+          "return sz %zu err %u", sz, ret[RET_BUF_ERR]);
+    for (size_t i = 0; i < sizeof(data); i++) {
+        CHECK(ret[RET_BUF_HDR_SZ + i] == data[i], "byte %zu is 0x%x", i, ret[RET_BUF_HDR_SZ + i]);
+    }
+    releaseRetBuf(BUS, ret);
+}
+
+static void testStartAddrKept(void)
+{
+    // The repeated START lands on the last slot of the first load, so it has to
+    // move to the second load along with its address
+    uint8_t req[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DATN(3), 0x00, 0x01, 0x02,
+                      I2C_TK_START, I2C_TK_ADDRR, I2C_TK_DATN(7), I2C_TK_DATA_END,
+                      I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DAT, 0x03, I2C_TK_STOP, I2C_TK_END };
+    const uint8_t data[] = { 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27 };
+    volatile oc4_host_if_t *regs = oc4HostIf(BUS);
+    queue(req, sizeof(req));
+
+    // Run every load before checking, so a failure leaves the bus idle
+    uint32_t last[2] = { tokenAt(regs, 14), tokenAt(regs, 15) }, first[2] = {0};
+    int loads = 0, reading = 0, next = 0;
+    while (regs->ctl & REG_CTRL_START) {
+        if (loads == 1) {
+            first[0] = tokenAt(regs, 0);
+            first[1] = tokenAt(regs, 1);
+        }
+        runLoad(BUS, &reading, data, &next);
+        notified(i2c_ifDesc[BUS].irq);
+        loads++;
+    }
+    size_t sz;
+    ret_buf_ptr_t ret = takeReturn(&sz);
+    int ok = ret && sz == RET_BUF_HDR_SZ + sizeof(data) && ret[RET_BUF_ERR] == I2C_ERR_OK;
+    if (ret) {
+        releaseRetBuf(BUS, ret);
+    }
+    CHECK(last[0] == OC4_I2C_TK_DATA_END && last[1] == OC4_I2C_TK_END,
+          "first load ends with %x %x", last[0], last[1]);
+    CHECK(first[0] == OC4_I2C_TK_START && first[1] == OC4_I2C_TK_ADDRW,
+          "second load starts with %x %x", first[0], first[1]);
+    CHECK(loads == 2, "%d loads", loads);
+    CHECK(ok, "return sz %zu", sz);
+}
+
+static void testNack(void)
+{
+    uint8_t req[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DAT, 0x55, I2C_TK_STOP, I2C_TK_END };
+    queue(req, sizeof(req));
+
+    // Target does not acknowledge its address
+    oc4HostFinish(BUS, NULL, 0, 1);
+    notified(i2c_ifDesc[BUS].irq);
+
+    size_t sz;
+    ret_buf_ptr_t ret = takeReturn(&sz);
+    CHECK(ret, "no return");
+    CHECK(ret[RET_BUF_ERR] == I2C_ERR_NACK && ret[RET_BUF_ERR_TK] == 1,
+          "err %u at token %u", ret[RET_BUF_ERR], ret[RET_BUF_ERR_TK]);
+    releaseRetBuf(BUS, ret);
+}
+
+static void testTimeout(void)
+{
+    uint8_t req[] = { I2C_TK_START, I2C_TK_ADDRR, I2C_TK_DATA_END, I2C_TK_STOP, I2C_TK_END };
+    queue(req, sizeof(req));
+
+    // Target holds SCL low until the timeout fires
+    notified(i2c_ifDesc[BUS].irq_to);
+
+    size_t sz;
+    ret_buf_ptr_t ret = takeReturn(&sz);
+    CHECK(ret, "no return");
+    CHECK(ret[RET_BUF_ERR] == I2C_ERR_TIMEOUT, "err %u", ret[RET_BUF_ERR]);
+    releaseRetBuf(BUS, ret);
+}
+
+// Finish whatever the driver has on the bus, as a plain write
+static void runWrites(void)
+{
+    volatile oc4_host_if_t *regs = oc4HostIf(BUS);
+    int reading = 0, next = 0;
+    while (regs->ctl & REG_CTRL_START) {
+        runLoad(BUS, &reading, NULL, &next);
+        notified(i2c_ifDesc[BUS].irq);
+    }
+}
+
+static void testOversizeRead(void)
+{
+    // 512 bytes of reads, more than the largest return buffer holds
+    uint8_t req[2 + 64 + 2];
+    size_t len = 0;
+    req[len++] = I2C_TK_START;
+    req[len++] = I2C_TK_ADDRR;
+    for (int i = 0; i < 64; i++) {
+        req[len++] = I2C_TK_DATN(8);
+    }
+    req[len++] = I2C_TK_STOP;
+    req[len++] = I2C_TK_END;
+    queue(req, len);
+    CHECK(!(oc4HostIf(BUS)->ctl & REG_CTRL_START), "oversize read started");
+
+    size_t sz;
+    ret_buf_ptr_t ret = takeReturn(&sz);
+    CHECK(ret, "no return");
+    CHECK(ret[RET_BUF_ERR] == I2C_ERR_MALFORMED, "err %u", ret[RET_BUF_ERR]);
+    releaseRetBuf(BUS, ret);
+
+    // The bus must still take the next request
+    uint8_t wr[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DAT, 0x01, I2C_TK_STOP, I2C_TK_END };
+    queue(wr, sizeof(wr));
+    CHECK(oc4HostIf(BUS)->ctl & REG_CTRL_START, "bus stuck after oversize read");
+    runWrites();
+    ret = takeReturn(&sz);
+    CHECK(ret && ret[RET_BUF_ERR] == I2C_ERR_OK, "write after oversize read failed");
+    releaseRetBuf(BUS, ret);
+}
+
+static void testRetExhausted(void)
+{
+    // Hold every return buffer of the bus, as a server slow to release them would
+    size_t cap = 64, held = 0;
+    ret_buf_ptr_t *bufs = malloc(cap * sizeof(*bufs));
+    ret_buf_ptr_t buf;
+    while ((buf = getRetBuf(BUS, RET_BUF_HDR_SZ))) {
+        if (held == cap) {
+            cap *= 2;
+            bufs = realloc(bufs, cap * sizeof(*bufs));
+        }
+        bufs[held++] = buf;
+    }
+
+    uint8_t wr[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DAT, 0x02, I2C_TK_STOP, I2C_TK_END };
+    queue(wr, sizeof(wr));
+    CHECK(!(oc4HostIf(BUS)->ctl & REG_CTRL_START), "started without a return buffer");
+    CHECK(i2c_ifState[BUS].backlog_count == 1, "request not held back");
+
+    // Releasing one must get the driver notified, and the request going
+    unsigned long notifies = server_notifies;
+    releaseRetBuf(BUS, bufs[--held]);
+    CHECK(retBufFreeNeedsNotify(BUS), "driver not told about the free return buffer");
+    CHECK(server_notifies == notifies, "spurious server notification");
+    notified(SERVER_NOTIFY_ID);
+    CHECK(oc4HostIf(BUS)->ctl & REG_CTRL_START, "bus stuck after return buffer freed");
+    runWrites();
+
+    size_t sz;
+    ret_buf_ptr_t ret = takeReturn(&sz);
+    CHECK(ret && ret[RET_BUF_ERR] == I2C_ERR_OK, "held back write failed");
+    releaseRetBuf(BUS, ret);
+    while (held) {
+        releaseRetBuf(BUS, bufs[--held]);
+    }
+    free(bufs);
+    CHECK(!retBufFreeNeedsNotify(BUS), "notify request left raised");
+}
+
+static void testAbortedReqBuf(void)
+{
+    // The driver is the only producer on the request free rings, so aborted
+    // buffers must come back from the server's own stash, most recent first
+    uint8_t *a, *b, *c, *d;
+    CHECK(!reserveReqBuf(BUS, &a, 16) && !reserveReqBuf(BUS, &b, 16), "reserve failed");
+    CHECK(!abortReqBuf(BUS, a) && !abortReqBuf(BUS, b), "abort failed");
+    CHECK(!reserveReqBuf(BUS, &c, 16) && c == b, "aborted buffer not reused");
+    CHECK(!reserveReqBuf(BUS, &d, 16) && d == a, "aborted buffer not reused");
+    CHECK(!abortReqBuf(BUS, c), "abort failed");
+
+    // A reused buffer still goes through to the driver
+    const uint8_t wr[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DATN(8), 0, 1, 2, 3, 4, 5, 6, 7,
+                           I2C_TK_STOP, I2C_TK_END };
+    memcpy(d, wr, sizeof(wr));
+    CHECK(!commitReqBuf(BUS, d, sizeof(wr), CLIENT, ADDR), "commit failed");
+    notified(SERVER_NOTIFY_ID);
+    CHECK(oc4HostIf(BUS)->ctl & REG_CTRL_START, "reused buffer not started");
+    runWrites();
+
+    size_t sz;
+    ret_buf_ptr_t ret = takeReturn(&sz);
+    CHECK(ret && ret[RET_BUF_ERR] == I2C_ERR_OK, "write from reused buffer failed");
+    releaseRetBuf(BUS, ret);
+}
+
+int main(int argc, char **argv)
+{
+    if (!(argc > 1 && !strcmp(argv[1], "-v"))) {
+        freopen("/dev/null", "w", stderr);
+    }
+
+    oc4HostInit();
+    sel4cp_host_notify_hook = onNotify;
+
+    // Server side of the transport lays out the rings, then the driver comes up
+    i2cTransportInit(1);
+    init();
+
+    testInit();
+    testWrite();
+    testRead();
+    testStartAddrKept();
+    testNack();
+    testTimeout();
+    testOversizeRead();
+    testAbortedReqBuf();
+    testRetExhausted();
+
+    if (failures) {
+        fprintf(stdout, "driver_harness: %d failure(s)\n", failures);
+        return 1;
+    }
+    fprintf(stdout, "driver_harness: ok (%lu server notifications, %lu irq acks)\n",
+           server_notifies, sel4cp_host_irq_acks);
+    return 0;
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// e2e_bench.c
+// End to end benchmark of the i2c stack on the host: the real server and driver
+// (built quiet, with their debug output compiled out) on sys_host.c and the list
+// processor model, with a DS3231 at 0x68 and the echo target at 0x24 on every
+// bus in use. Clients are spread over the buses and each keeps one transaction
+// in flight, submitting the next as soon as the server hands back the return of
+// the last. A transaction is either a short read (register pointer write, then
+// two bytes read from the DS3231) or a long write to the echo target.
+//
+// Runs either on one thread, as both PDs would on a single core, or with the
+// driver and the model on a second thread, as with the PDs on separate cores.
+// Reports, per run:
+//   - transactions per second of wall time, and p50/p99/p999 wall latency from
+//     submission to the server releasing the return
+//   - the same from simulated time, which is what the bus itself allows
+//   - process CPU time and CPU cycles per transaction, the latter from the
+//     cycle counter where perf_event_open allows it and 0 otherwise
+//
+// Usage: e2e_bench [-n txns] [-b buses] [-k clients] [-w pct] [-l len] [-t 1|2] [-c]
+//   -n   transactions per run, after a tenth as many to warm up (default 20000)
+//   -b   buses, 1 to 4
+//   -k   clients, spread over the buses (at most 64)
+//   -w   percentage of transactions that are long writes
+//   -l   bytes per long write, 1 to 32 (default 32)
+//   -t   1 for single-threaded, 2 for the driver on its own thread
+//   -c   print CSV instead of a table
+// Without any of -b, -k, -w or -t, it sweeps both modes over 1, 2 and 4 buses,
+// 1 and 4 clients a bus, and 0, 20 and 100% long writes.
+
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "i2c-token.h"
+#include "i2c-transport.h"
+#include "oc4-sim.h"
+#include "sys-host.h"
+
+#define MAX_CLIENTS 64
+// Client ids of the benchmark start here, clear of the server's own tests
+#define CLIENT_BASE 16
+
+#define RTC_ADDR 0x68
+#define ECHO_ADDR 0x24
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct {
+    int bus;
+    uint64_t issued;        // Wall time the transaction in flight was submitted
+    uint64_t issued_sim;    // ...and simulated time
+    uint32_t rng;
+} client_t;
+
+typedef struct {
+    int threads;
+    int buses;
+    int clients;
+    int write_pct;
+} config_t;
+
+static unsigned long txns = 20000;
+static int write_len = 32;
+
+static client_t clients[MAX_CLIENTS];
+static int nclients;
+static sim_ds3231_t rtcs[I2C_NUM_BUSES];
+static sim_echo_t echos[I2C_NUM_BUSES];
+
+// Clients whose last transaction came back, waiting to submit the next
+static int ready[MAX_CLIENTS];
+static int nready;
+
+// Completions, counted from the start of the run
+static unsigned long done;
+static unsigned long warmup;
+static unsigned long errors;
+static uint64_t *lat;
+static uint64_t *lat_sim;
+static unsigned long nlat;
+
+// Start of the measured part of the run, once the warm up is over
+static uint64_t start, start_sim, start_cpu;
+static int perf = -1;
+
+static int ncpus;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+    if (ncpus < 2) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % ncpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/**
+ * Open a user space cycle counter for this thread and any it starts later.
+ * @return the perf fd, or -1 if the kernel does not allow it.
+ */
+static int cyclesOpen(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cyclesRead(int fd)
+{
+    uint64_t count = 0;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    return count;
+}
+
+static inline uint32_t xorshift(uint32_t *s)
+{
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+static void submit(int c, int write_pct)
+{
+    client_t *cl = &clients[c];
+    uint8_t req[64];
+    size_t len = 0;
+    uint8_t addr;
+
+    req[len++] = I2C_TK_START;
+    req[len++] = I2C_TK_ADDRW;
+    if ((int)(xorshift(&cl->rng) % 100) < write_pct) {
+        addr = ECHO_ADDR;
+        for (int left = write_len; left > 0; left -= I2C_TK_DATN_MAX) {
+            int n = left < I2C_TK_DATN_MAX ? left : I2C_TK_DATN_MAX;
+            req[len++] = I2C_TK_DATN(n);
+            for (int i = 0; i < n; i++) {
+                req[len++] = (uint8_t)(c + i);
+            }
+        }
+    } else {
+        addr = RTC_ADDR;
+        req[len++] = I2C_TK_DAT;
+        req[len++] = 0x00;
+        req[len++] = I2C_TK_START;
+        req[len++] = I2C_TK_ADDRR;
+        req[len++] = I2C_TK_DAT;
+        req[len++] = I2C_TK_DATA_END;
+    }
+    req[len++] = I2C_TK_STOP;
+    req[len++] = I2C_TK_END;
+
+    cl->issued = now_ns();
+    cl->issued_sim = oc4SimNow();
+    if (sysHostSubmit(cl->bus, req, len, CLIENT_BASE + c, addr)) {
+        fprintf(stdout, "e2e_bench: bus %d full\n", cl->bus);
+        exit(1);
+    }
+}
+
+static void markStart(void)
+{
+    start = now_ns();
+    start_sim = oc4SimNow();
+    start_cpu = cpu_ns();
+    if (perf >= 0) {
+        ioctl(perf, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+int __real_releaseRetBuf(int bus, ret_buf_ptr_t buf);
+
+/**
+ * The server releases every return once it has handled it, which is where a
+ * transaction ends. The link wraps releaseRetBuf to catch it there, without
+ * changes to i2c.c.
+ */
+int __wrap_releaseRetBuf(int bus, ret_buf_ptr_t buf)
+{
+    int c = buf[RET_BUF_CLIENT] - CLIENT_BASE;
+    if (c >= 0 && c < nclients) {
+        if (done >= warmup && nlat < txns) {
+            lat[nlat] = now_ns() - clients[c].issued;
+            lat_sim[nlat] = oc4SimNow() - clients[c].issued_sim;
+            nlat++;
+            if (buf[RET_BUF_ERR]) {
+                errors++;
+            }
+        }
+        if (++done == warmup) {
+            markStart();
+        }
+        ready[nready++] = c;
+    }
+    return __real_releaseRetBuf(bus, buf);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static inline uint64_t percentile(const uint64_t *sorted, unsigned long n, unsigned long per_mille)
+{
+    return n ? sorted[(n * per_mille) / 1000] : 0;
+}
+
+static void setup(const config_t *cfg)
+{
+    oc4SimInit();
+    for (int b = 0; b < cfg->buses; b++) {
+        oc4SimAttach(b, simDs3231(&rtcs[b], RTC_ADDR));
+        oc4SimAttach(b, simEcho(&echos[b], ECHO_ADDR));
+    }
+    // M2 needs its DS3231 for the server's own test, which runs from its init
+    if (cfg->buses <= 2) {
+        oc4SimAttach(2, simDs3231(&rtcs[2], RTC_ADDR));
+    }
+    sysHostInit();
+    sysHostRun();
+
+    nclients = cfg->clients;
+    for (int c = 0; c < nclients; c++) {
+        clients[c] = (client_t) { .bus = c % cfg->buses, .rng = 2463534242U + c };
+    }
+    done = 0;
+    errors = 0;
+    nlat = 0;
+    warmup = txns / 10;
+}
+
+static void run(const config_t *cfg, int csv)
+{
+    setup(cfg);
+
+    // Opened before the driver thread starts, so the thread inherits it
+    perf = cyclesOpen();
+    if (cfg->threads == 2) {
+        sysHostStartThreads(ncpus < 2 ? -1 : 1);
+    }
+
+    unsigned long total = warmup + txns;
+    unsigned long issued = 0;
+
+    nready = 0;
+    for (int c = 0; c < nclients; c++) {
+        ready[nready++] = c;
+    }
+    if (!warmup) {
+        markStart();
+    }
+    while (done < total) {
+        // Only as many submissions as are still needed, so the run ends idle
+        while (nready && issued < total) {
+            submit(ready[--nready], cfg->write_pct);
+            issued++;
+        }
+        sysHostStep();
+    }
+    uint64_t elapsed = now_ns() - start;
+    uint64_t elapsed_sim = oc4SimNow() - start_sim;
+    uint64_t used_cpu = cpu_ns() - start_cpu;
+    if (perf >= 0) {
+        ioctl(perf, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    if (cfg->threads == 2) {
+        sysHostStopThreads();
+    }
+    // The driver thread's count is only folded in once it has exited
+    uint64_t cycles = cyclesRead(perf);
+    if (perf >= 0) {
+        close(perf);
+    }
+
+    qsort(lat, nlat, sizeof(uint64_t), cmp_u64);
+    qsort(lat_sim, nlat, sizeof(uint64_t), cmp_u64);
+    double rate = nlat / (elapsed / 1e9);
+    double rate_sim = elapsed_sim ? nlat / (elapsed_sim / 1e9) : 0;
+    const char *mode = cfg->threads == 2 ? "threaded" : "single";
+
+    if (csv) {
+        printf("%s,%d,%d,%d,%d,%lu,%lu,%.0f,%lu,%lu,%lu,%.0f,%lu,%lu,%lu,%.0f,%.0f\n",
+               mode, cfg->buses, cfg->clients, cfg->write_pct, write_len, nlat, errors,
+               rate, (unsigned long)percentile(lat, nlat, 500),
+               (unsigned long)percentile(lat, nlat, 990), (unsigned long)percentile(lat, nlat, 999),
+               rate_sim, (unsigned long)percentile(lat_sim, nlat, 500),
+               (unsigned long)percentile(lat_sim, nlat, 990), (unsigned long)percentile(lat_sim, nlat, 999),
+               (double)used_cpu / nlat, (double)cycles / nlat);
+    } else {
+        printf("%-8s %5d %7d %5d%% %10.0f %8lu %8lu %8lu %9.0f %8lu %8lu %8.0f %8.0f%s\n",
+               mode, cfg->buses, cfg->clients, cfg->write_pct, rate,
+               (unsigned long)percentile(lat, nlat, 500), (unsigned long)percentile(lat, nlat, 990),
+               (unsigned long)percentile(lat, nlat, 999), rate_sim,
+               (unsigned long)percentile(lat_sim, nlat, 500), (unsigned long)percentile(lat_sim, nlat, 990),
+               (double)used_cpu / nlat, (double)cycles / nlat, errors ? " errors" : "");
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n txns] [-b buses] [-k clients] [-w pct] [-l len] [-t 1|2] [-c]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    config_t cfg = { .threads = 1, .buses = 1, .clients = 1, .write_pct = 20 };
+    int sweep = 1, csv = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c")) {
+            csv = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        long v = strtol(argv[++i], NULL, 0);
+        if (!strcmp(argv[i - 1], "-n") && v > 0) {
+            txns = v;
+        } else if (!strcmp(argv[i - 1], "-l") && v > 0 && v <= SIM_ECHO_BUF_SZ) {
+            write_len = v;
+        } else if (!strcmp(argv[i - 1], "-b") && v > 0 && v <= I2C_NUM_BUSES) {
+            cfg.buses = v;
+            sweep = 0;
+        } else if (!strcmp(argv[i - 1], "-k") && v > 0 && v <= MAX_CLIENTS) {
+            cfg.clients = v;
+            sweep = 0;
+        } else if (!strcmp(argv[i - 1], "-w") && v >= 0 && v <= 100) {
+            cfg.write_pct = v;
+            sweep = 0;
+        } else if (!strcmp(argv[i - 1], "-t") && (v == 1 || v == 2)) {
+            cfg.threads = v;
+            sweep = 0;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pin(0);
+    lat = malloc(txns * sizeof(uint64_t));
+    lat_sim = malloc(txns * sizeof(uint64_t));
+
+    // The server and driver report through stderr, which is only the shim's
+    // own messages in the quiet build
+    freopen("/dev/null", "w", stderr);
+
+    if (csv) {
+        printf("mode,buses,clients,write_pct,write_len,txns,errors,"
+               "txns_per_sec,p50_ns,p99_ns,p999_ns,"
+               "sim_txns_per_sec,sim_p50_ns,sim_p99_ns,sim_p999_ns,"
+               "cpu_ns_per_txn,cycles_per_txn\n");
+    } else {
+        printf("end to end: %lu transactions a run, long writes of %d bytes, %d cpu(s)\n",
+               txns, write_len, ncpus);
+        printf("%-8s %5s %7s %6s %10s %8s %8s %8s %9s %8s %8s %8s %8s\n",
+               "mode", "buses", "clients", "writes", "txns/sec", "p50 ns", "p99 ns", "p999 ns",
+               "sim t/s", "sim p50", "sim p99", "cpu ns", "cycles");
+    }
+
+    if (!sweep) {
+        run(&cfg, csv);
+        return 0;
+    }
+    static const int buses[] = { 1, 2, 4 };
+    static const int per_bus[] = { 1, 4 };
+    static const int mix[] = { 0, 20, 100 };
+    for (int t = 1; t <= 2; t++) {
+        for (size_t b = 0; b < ARRAY_SIZE(buses); b++) {
+            for (size_t k = 0; k < ARRAY_SIZE(per_bus); k++) {
+                for (size_t w = 0; w < ARRAY_SIZE(mix); w++) {
+                    config_t c = {
+                        .threads = t,
+                        .buses = buses[b],
+                        .clients = buses[b] * per_bus[k],
+                        .write_pct = mix[w],
+                    };
+                    run(&c, csv);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// i2c_sim.c
+// Runs the server and driver against the list processor model, with a DS3231
+// at 0x68, a 24C32 EEPROM at 0x50 and the echo target at 0x24 on M2. The
+// server's own init queues its DS3231 test; this then adds an echo round trip,
+// an EEPROM page write with ACK polling and read back, and a full DS3231 time
+// read. Reports what each target ended up holding and the bus time accounting
+// of every bus, and exits non-zero if a target does not hold what was written.
+//
+// Usage: i2c_sim [-v]
+//   -v   keep the server's and driver's debug output (discarded by default)
+
+#include <stdio.h>
+#include <string.h>
+#include "i2c-token.h"
+#include "i2c-transport.h"
+#include "oc4-sim.h"
+#include "sys-host.h"
+
+#define BUS 2
+#define CLIENT 1
+
+static sim_ds3231_t rtc;
+static sim_eeprom_t eeprom;
+static sim_echo_t echo;
+
+static void echoRoundTrip(void)
+{
+    uint8_t wr[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DATN(3), 0x03, 0x02, 0x01, I2C_TK_STOP, I2C_TK_END };
+    uint8_t rd[] = { I2C_TK_START, I2C_TK_ADDRR, I2C_TK_DATN(2), I2C_TK_DATA_END, I2C_TK_STOP, I2C_TK_END };
+    sysHostSubmit(BUS, wr, sizeof(wr), CLIENT, 0x24);
+    sysHostSubmit(BUS, rd, sizeof(rd), CLIENT, 0x24);
+    sysHostRun();
+}
+
+static void eepromPage(void)
+{
+    // 16 bytes at 0x0100
+    uint8_t wr[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DAT, 0x01, I2C_TK_DAT, 0x00,
+                     I2C_TK_DATN(8), 0, 1, 2, 3, 4, 5, 6, 7,
+                     I2C_TK_DATN(8), 8, 9, 10, 11, 12, 13, 14, 15,
+                     I2C_TK_STOP, I2C_TK_END };
+    sysHostSubmit(BUS, wr, sizeof(wr), CLIENT, 0x50);
+    sysHostRun();
+
+    // Poll for the end of the write cycle with an empty write
+    uint8_t poll[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_STOP, I2C_TK_END };
+    unsigned long nacks = oc4SimStats(BUS)->nacks;
+    do {
+        nacks = oc4SimStats(BUS)->nacks;
+        sysHostSubmit(BUS, poll, sizeof(poll), CLIENT, 0x50);
+        sysHostRun();
+    } while (oc4SimStats(BUS)->nacks != nacks);
+
+    uint8_t rd[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DAT, 0x01, I2C_TK_DAT, 0x00,
+                     I2C_TK_START, I2C_TK_ADDRR, I2C_TK_DATN(8), I2C_TK_DATN(7), I2C_TK_DATA_END,
+                     I2C_TK_STOP, I2C_TK_END };
+    sysHostSubmit(BUS, rd, sizeof(rd), CLIENT, 0x50);
+    sysHostRun();
+}
+
+static void rtcTime(void)
+{
+    uint8_t rd[] = { I2C_TK_START, I2C_TK_ADDRW, I2C_TK_DAT, 0x00,
+                     I2C_TK_START, I2C_TK_ADDRR, I2C_TK_DATN(6), I2C_TK_DATA_END,
+                     I2C_TK_STOP, I2C_TK_END };
+    sysHostSubmit(BUS, rd, sizeof(rd), CLIENT, 0x68);
+    sysHostRun();
+}
+
+int main(int argc, char **argv)
+{
+    if (!(argc > 1 && !strcmp(argv[1], "-v"))) {
+        freopen("/dev/null", "w", stderr);
+    }
+
+    oc4SimInit();
+    oc4SimAttach(BUS, simDs3231(&rtc, 0x68));
+    oc4SimAttach(BUS, simEeprom24(&eeprom, 0x50, 32));
+    oc4SimAttach(BUS, simEcho(&echo, 0x24));
+
+    sysHostInit();
+    sysHostRun();
+    echoRoundTrip();
+    eepromPage();
+    rtcTime();
+
+    int bad = 0;
+    fprintf(stdout, "ds3231: year 0x%02x, month 0x%02x\n", rtc.regs[6], rtc.regs[7]);
+    bad |= rtc.regs[6] != 0x20 || rtc.regs[7] != 0x24;
+    fprintf(stdout, "echo:   holds %zu bytes, %zu read back\n", echo.len, echo.pos);
+    bad |= echo.len != 3 || echo.pos != 3;
+    for (int i = 0; i < 16; i++) {
+        bad |= eeprom.mem[0x100 + i] != i;
+    }
+    fprintf(stdout, "24c32:  page at 0x100 %s\n", bad ? "wrong" : "written");
+
+    fprintf(stdout, "%-4s %6s %8s %8s %6s %9s %12s\n",
+            "bus", "loads", "rd bytes", "wr bytes", "nacks", "timeouts", "busy ns");
+    for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        const oc4_sim_stats_t *s = oc4SimStats(bus);
+        fprintf(stdout, "m%-3d %6lu %8lu %8lu %6lu %9lu %12lu\n", bus, s->loads, s->rd_bytes,
+                s->wr_bytes, s->nacks, s->timeouts, (unsigned long)s->busy_ns);
+    }
+    fprintf(stdout, "simulated time: %lu ns\n", (unsigned long)oc4SimNow());
+    return bad;
+}
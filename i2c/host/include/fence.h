@@ -0,0 +1,18 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// fence.h
+// Host stand-in for sDDF's util/include/fence.h.
+
+#pragma once
+
+#define COMPILER_MEMORY_FENCE() __atomic_signal_fence(__ATOMIC_ACQ_REL)
+// A full barrier, as the dmb the real one compiles to on aarch64 is. The ring
+// signalling handshake relies on stores not passing later loads, which an
+// acq_rel fence does not stop on x86.
+#define THREAD_MEMORY_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define THREAD_MEMORY_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define THREAD_MEMORY_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// oc4-host.h
+// Host stand-in for the ODROID C4 memory regions. Backs the i2c, gpio and clk
+// device regions, and the rings, buffers and program cache shared by the server
+// and driver, with ordinary memory, and points the setvar symbols of each at
+// it. Harnesses then play the part of the list processor through the register
+// blocks below.
+
+#ifndef OC4_HOST_H
+#define OC4_HOST_H
+
+#include <stdint.h>
+
+// Register block of one master, matching i2c_if_t in i2c-odroid-c4.c
+typedef struct oc4_host_if {
+    uint32_t ctl;
+    uint32_t addr;
+    uint32_t tk_list0;
+    uint32_t tk_list1;
+    uint32_t wdata0;
+    uint32_t wdata1;
+    uint32_t rdata0;
+    uint32_t rdata1;
+} oc4_host_if_t;
+
+/**
+ * Allocate every region the server and driver map in i2c.system and set the
+ * matching symbols, as the elf patcher would. Call before either side's init.
+ * Calling it again clears the regions for a fresh run.
+ */
+void oc4HostInit(void);
+
+/**
+ * Register block of a bus's master within the `i2c` region.
+ */
+volatile oc4_host_if_t *oc4HostIf(int bus);
+
+/**
+ * Finish the load running on a bus as the list processor would: clear START and
+ * STATUS and report how far it got.
+ * @param rdata: Bytes read by the load, or NULL
+ * @param rd_cnt: Number of bytes in rdata, at most 8
+ * @param err_tk: Index of the token that failed, or -1 for success
+ */
+void oc4HostFinish(int bus, const uint8_t *rdata, int rd_cnt, int err_tk);
+
+#endif
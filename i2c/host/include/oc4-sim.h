@@ -0,0 +1,134 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// oc4-sim.h
+// Behavioural model of the S905X3 i2c list processor, run against the register
+// blocks of oc4-host.h. Each load the driver starts is run token by token
+// against the virtual targets attached to the bus, filling in rdata0/1 and the
+// ctl status, error, current token and read count fields, and takes simulated
+// bus time worked out from the SCL timing the driver programmed. Loads finish
+// in order of simulated time, each raising the completion or timeout IRQ of its
+// bus.
+//
+// Two simplifications against the hardware: the model clears START when a load
+// finishes, so every START the driver writes is seen as a new load, and a load
+// only starts when the harness calls oc4SimNext.
+
+#ifndef OC4_SIM_H
+#define OC4_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Replies of a target to a byte on the bus
+#define OC4_SIM_ACK 0
+#define OC4_SIM_NACK 1
+#define OC4_SIM_STRETCH 2       // Hold SCL low until the master times out
+
+// How long the master waits on a stretched SCL before raising its timeout IRQ
+#ifndef OC4_SIM_TIMEOUT_NS
+#define OC4_SIM_TIMEOUT_NS 10000000ULL
+#endif
+
+typedef struct oc4_sim_target oc4_sim_target_t;
+
+// A virtual device on the bus. Unset callbacks ACK and read as 0xFF.
+struct oc4_sim_target {
+    const char *name;
+    uint8_t addr;               // 7-bit address
+    // Addressed after a START or repeated START. read is 1 for ADDRR.
+    int (*start)(oc4_sim_target_t *t, int read);
+    // Byte written by the master
+    int (*write)(oc4_sim_target_t *t, uint8_t byte);
+    // Byte read by the master. last is 1 if the master NACKs it (DATA_END).
+    int (*read)(oc4_sim_target_t *t, int last, uint8_t *byte);
+    // STOP, or the master giving up after an error
+    void (*stop)(oc4_sim_target_t *t);
+    oc4_sim_target_t *next;     // Next target on the same bus
+};
+
+// Bus time accounting for one master
+typedef struct oc4_sim_stats {
+    unsigned long loads;
+    unsigned long rd_bytes;
+    unsigned long wr_bytes;
+    unsigned long nacks;
+    unsigned long timeouts;
+    uint64_t busy_ns;           // Simulated time the bus spent running loads
+} oc4_sim_stats_t;
+
+/**
+ * Reset the model: no loads running, no targets and simulated time 0. Call
+ * after oc4HostInit.
+ */
+void oc4SimInit(void);
+
+/**
+ * Put a target on a bus.
+ * @return 0 on success, -1 if the bus does not exist or the address is taken.
+ */
+int oc4SimAttach(int bus, oc4_sim_target_t *t);
+
+/**
+ * Simulated time in ns.
+ */
+uint64_t oc4SimNow(void);
+
+/**
+ * Start any loads the driver has kicked off since the last call, then advance
+ * simulated time to the next load to finish and finish it.
+ * @return the driver IRQ channel it raises, or -1 if no load is running.
+ */
+int oc4SimNext(void);
+
+/**
+ * Bus time accounting for a bus.
+ */
+const oc4_sim_stats_t *oc4SimStats(int bus);
+
+// Virtual targets, in oc4_sim_targets.c
+
+// DS3231 real time clock. 19 registers behind an auto-incrementing pointer
+// that the first byte of a write sets.
+#define SIM_DS3231_REGS 0x13
+typedef struct sim_ds3231 {
+    oc4_sim_target_t t;
+    uint8_t regs[SIM_DS3231_REGS];
+    uint8_t ptr;
+    int first;                  // Next write byte sets ptr
+} sim_ds3231_t;
+oc4_sim_target_t *simDs3231(sim_ds3231_t *dev, uint8_t addr);
+
+// 24Cxx EEPROM. Up to 16 kbit takes a one byte address, larger parts two.
+// Writes wrap within a page, and after the STOP the part is busy writing for
+// SIM_EEPROM_TWR_NS and does not acknowledge its address, as the real part
+// does to support ACK polling.
+#define SIM_EEPROM_TWR_NS 5000000ULL
+typedef struct sim_eeprom {
+    oc4_sim_target_t t;
+    uint8_t *mem;
+    uint32_t size;              // Bytes
+    uint32_t page;              // Bytes per write page
+    int addr_bytes;
+    uint32_t ptr;
+    int addr_left;              // Address bytes still to come in this write
+    int wrote;                  // Data was written since the START
+    uint64_t busy_until;        // End of the internal write cycle
+} sim_eeprom_t;
+oc4_sim_target_t *simEeprom24(sim_eeprom_t *dev, uint8_t addr, uint32_t kbits);
+
+// Echo target, as test/echo-mega2560 is meant to be: bytes written to it are
+// read back in the same order. Reading past them gives 0xFF.
+#define SIM_ECHO_BUF_SZ 32      // Wire library buffer
+typedef struct sim_echo {
+    oc4_sim_target_t t;
+    uint8_t buf[SIM_ECHO_BUF_SZ];
+    size_t len;
+    size_t pos;
+} sim_echo_t;
+oc4_sim_target_t *simEcho(sim_echo_t *dev, uint8_t addr);
+
+#endif
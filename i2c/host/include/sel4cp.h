@@ -0,0 +1,60 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// sel4cp.h
+// Host stand-in for the seL4 core platform header. Provides just enough of the
+// libsel4cp interface for the i2c sources to compile and run as ordinary Linux
+// programs. Only used by the targets in host/Makefile. Channel and message
+// register calls are implemented in sel4cp_host.c, which lets a harness watch
+// them.
+
+#ifndef HOST_SEL4CP_H
+#define HOST_SEL4CP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef unsigned int sel4cp_channel;
+typedef uint64_t seL4_Word;
+typedef struct { seL4_Word words[1]; } seL4_MessageInfo_t;
+
+#define SEL4CP_HOST_MRS 64
+
+// Building with SEL4CP_HOST_QUIET compiles debug output out, printf included,
+// so benchmarks measure the code rather than the console
+#ifdef SEL4CP_HOST_QUIET
+#define printf_ sel4cp_host_quiet_printf
+int sel4cp_host_quiet_printf(const char *format, ...);
+
+static inline void sel4cp_dbg_putc(int c) {}
+static inline void sel4cp_dbg_puts(const char *s) {}
+#else
+static inline void sel4cp_dbg_putc(int c)
+{
+    fputc(c, stderr);
+}
+
+static inline void sel4cp_dbg_puts(const char *s)
+{
+    fputs(s, stderr);
+}
+#endif
+
+void sel4cp_notify(sel4cp_channel ch);
+void sel4cp_irq_ack(sel4cp_channel ch);
+seL4_Word sel4cp_mr_get(uint8_t mr);
+void sel4cp_mr_set(uint8_t mr, seL4_Word value);
+seL4_MessageInfo_t sel4cp_msginfo_new(seL4_Word label, uint16_t count);
+seL4_Word sel4cp_msginfo_get_label(seL4_MessageInfo_t msginfo);
+
+// Called on every sel4cp_notify / sel4cp_irq_ack if set, so a harness can
+// stand in for the other end of a channel. Unset, the calls are just counted.
+extern void (*sel4cp_host_notify_hook)(sel4cp_channel ch);
+extern void (*sel4cp_host_irq_ack_hook)(sel4cp_channel ch);
+extern unsigned long sel4cp_host_notifies;
+extern unsigned long sel4cp_host_irq_acks;
+
+#endif
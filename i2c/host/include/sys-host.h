@@ -0,0 +1,73 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// sys-host.h
+// Host stand-in for i2c.system: the real server (i2c.c) and driver
+// (i2c-odroid-c4.c) in one Linux process, on top of the sel4cp shim, the
+// region mock and the list processor model. Notifications are delivered as
+// seL4 would on a single core: the driver (priority 201) runs as soon as the
+// server notifies it, while the server (200) only sees the driver's
+// notifications once the driver returns. Alternatively each PD gets a thread
+// of its own, as on a multicore system with the PDs on different cores. The
+// two sources are built with their entry points renamed, see host/Makefile.
+
+#ifndef SYS_HOST_H
+#define SYS_HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sel4cp.h>
+
+// Entry points of the two protection domains
+void server_init(void);
+void server_notified(sel4cp_channel ch);
+void driver_init(void);
+void driver_notified(sel4cp_channel ch);
+
+/**
+ * Allocate the shared regions and run the driver's and then the server's init,
+ * as the system would by priority. Reset the list processor model and attach
+ * its targets first, as the server's init may already talk to them.
+ */
+void sysHostInit(void);
+
+/**
+ * Queue a request from the server's side of the transport and notify the
+ * driver if it is idle on the bus, as the server's notifyDriver does.
+ * @return 0 on success, -1 if the bus is full.
+ */
+int sysHostSubmit(int bus, const uint8_t *tokens, size_t len, uint8_t client, uint8_t addr);
+
+/**
+ * Deliver notifications and finish loads on the list processor model, in
+ * simulated time order, until nothing is left to do. Not for threaded mode,
+ * where the system is never seen to be idle.
+ */
+void sysHostRun(void);
+
+/**
+ * Deliver pending notifications, then finish the next load to end.
+ * In threaded mode, wait for a notification to the server and deliver it
+ * instead; only call it with requests outstanding.
+ * @return 0 if there was something to do, -1 if the system is idle.
+ */
+int sysHostStep(void);
+
+/**
+ * Switch to threaded mode: the driver and the list processor model run on a
+ * new thread, pinned to driver_cpu unless it is negative, and the calling
+ * thread becomes the server. Notifications wake the PD they are for rather
+ * than running it in place. Call after sysHostInit.
+ */
+void sysHostStartThreads(int driver_cpu);
+
+/**
+ * Let the driver thread finish what it has pending, then stop it and return
+ * to running both PDs on the calling thread.
+ */
+void sysHostStopThreads(void);
+
+#endif
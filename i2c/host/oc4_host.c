@@ -0,0 +1,78 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// oc4_host.c
+// Host stand-in for the ODROID C4 memory regions. See include/oc4-host.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oc4-host.h"
+#include "odroidc4-i2c-mem.h"
+#include "i2c-transport.h"
+#include "i2c-prog.h"
+
+// Set by the elf patcher on the board. Defined by the driver and transport.
+extern uintptr_t i2c;
+extern uintptr_t gpio;
+extern uintptr_t clk;
+
+// Region sizes, matching i2c.system
+#define I2C_REGION_SZ 0x4000
+#define GPIO_REGION_SZ 0x4000
+#define CLK_REGION_SZ 0x1000
+
+// The masters sit 0x1000 apart, M3 first
+#define IF_OFFSET(bus) ((3 - (bus)) * 0x1000)
+
+// Allocated on first use, and cleared again on every later init
+static uintptr_t region(uintptr_t mem, size_t size)
+{
+    if (!mem) {
+        mem = (uintptr_t)aligned_alloc(0x1000, size);
+        if (!mem) {
+            fprintf(stderr, "oc4_host: failed to allocate %zu bytes\n", size);
+            exit(1);
+        }
+    }
+    memset((void *)mem, 0, size);
+    return mem;
+}
+
+void oc4HostInit(void)
+{
+    i2c = region(i2c, I2C_REGION_SZ);
+    gpio = region(gpio, GPIO_REGION_SZ);
+    clk = region(clk, CLK_REGION_SZ);
+    i2c_rings = region(i2c_rings, I2C_RING_REGION_SZ);
+    driver_bufs = region(driver_bufs, I2C_DRIVER_BUFS_SZ);
+    i2c_progs = region(i2c_progs, I2C_PROG_REGION_SZ);
+}
+
+volatile oc4_host_if_t *oc4HostIf(int bus)
+{
+    return (volatile oc4_host_if_t *)(i2c + IF_OFFSET(bus));
+}
+
+void oc4HostFinish(int bus, const uint8_t *rdata, int rd_cnt, int err_tk)
+{
+    volatile oc4_host_if_t *regs = oc4HostIf(bus);
+    uint32_t rd[2] = {0, 0};
+    for (int i = 0; i < rd_cnt && i < 8; i++) {
+        rd[i / 4] |= (uint32_t)rdata[i] << ((i % 4) * 8);
+    }
+    regs->rdata0 = rd[0];
+    regs->rdata1 = rd[1];
+
+    uint32_t ctl = regs->ctl & ~(REG_CTRL_START | REG_CTRL_STATUS | REG_CTRL_ERROR |
+                                 REG_CTRL_CURR_TK | REG_CTRL_RD_CNT);
+    if (err_tk >= 0) {
+        ctl |= REG_CTRL_ERROR | ((uint32_t)err_tk << 4);
+    } else {
+        ctl |= (uint32_t)rd_cnt << 8;
+    }
+    regs->ctl = ctl;
+}
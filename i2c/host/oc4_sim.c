@@ -0,0 +1,272 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// oc4_sim.c
+// Behavioural model of the S905X3 i2c list processor. See include/oc4-sim.h.
+
+#include <stdio.h>
+#include <string.h>
+#include "oc4-host.h"
+#include "oc4-sim.h"
+#include "odroidc4-i2c-mem.h"
+#include "i2c-transport.h"
+
+// Bus time of each token, in SCL periods
+#define START_PERIODS 1
+#define BYTE_PERIODS 9      // 8 bits and the ACK
+#define STOP_PERIODS 1
+
+// Cycles of clk81 to wait between the list processor starting and SCL moving
+#define LOAD_OVERHEAD_CYCLES 16
+
+// Per master state of the model
+typedef struct sim_bus {
+    oc4_sim_target_t *targets;
+    oc4_sim_target_t *sel;  // Target addressed in the current transfer
+    int reading;            // Data direction of the current transfer
+    int running;            // A load is on the bus
+    int timeout;            // ...and it ends in a timeout
+    uint64_t done_at;       // Simulated time it ends, in ns
+    uint32_t ctl;           // ctl status fields to report when it ends
+    uint32_t rdata[2];
+    oc4_sim_stats_t stats;
+} sim_bus_t;
+
+static sim_bus_t buses[I2C_NUM_BUSES];
+
+// Only the thread running the model advances it, but others may read it
+static uint64_t now;
+
+static const struct {
+    int irq;
+    int irq_to;
+} irqs[I2C_NUM_BUSES] = {
+    { IRQ_I2C_M0, IRQ_I2C_M0_TO },
+    { IRQ_I2C_M1, IRQ_I2C_M1_TO },
+    { IRQ_I2C_M2, IRQ_I2C_M2_TO },
+    { IRQ_I2C_M3, IRQ_I2C_M3_TO },
+};
+
+void oc4SimInit(void)
+{
+    memset(buses, 0, sizeof(buses));
+    __atomic_store_n(&now, 0, __ATOMIC_RELAXED);
+}
+
+int oc4SimAttach(int bus, oc4_sim_target_t *t)
+{
+    if ((unsigned int)bus >= I2C_NUM_BUSES || t->addr > 0x7F) {
+        return -1;
+    }
+    for (oc4_sim_target_t *o = buses[bus].targets; o; o = o->next) {
+        if (o->addr == t->addr) {
+            return -1;
+        }
+    }
+    t->next = buses[bus].targets;
+    buses[bus].targets = t;
+    return 0;
+}
+
+uint64_t oc4SimNow(void)
+{
+    return __atomic_load_n(&now, __ATOMIC_RELAXED);
+}
+
+const oc4_sim_stats_t *oc4SimStats(int bus)
+{
+    return &buses[bus].stats;
+}
+
+static inline uint64_t cyclesToNs(uint64_t cycles)
+{
+    return cycles * 1000000000ULL / I2C_CLK81_RATE;
+}
+
+/**
+ * Length of an SCL period in clk81 cycles, from the divider and SCL delay the
+ * driver programmed. With the SCL delay enabled, the high period is the divider
+ * plus the input filter delay and the low period is the delay in half cycles.
+ * Otherwise the clock is taken as symmetric.
+ */
+static uint64_t sclPeriod(volatile oc4_host_if_t *regs)
+{
+    uint32_t ctl = regs->ctl;
+    uint64_t div = ((ctl & REG_CTRL_CLKDIV_MASK) >> REG_CTRL_CLKDIV_SHIFT) |
+                   (((ctl & REG_CTRL_CLKDIVEXT_MASK) >> REG_CTRL_CLKDIVEXT_SHIFT) << 10);
+    uint64_t high = div + I2C_FILTER_DELAY;
+    uint64_t low = high;
+    if (regs->addr & REG_ADDR_SCLDELAY_ENABLE) {
+        low = 2 * ((regs->addr & REG_ADDR_SCLDELAY_MASK) >> REG_ADDR_SCLDELAY_SHFT);
+    }
+    return high + low;
+}
+
+static oc4_sim_target_t *findTarget(sim_bus_t *b, uint8_t addr)
+{
+    for (oc4_sim_target_t *t = b->targets; t; t = t->next) {
+        if (t->addr == addr) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// Let go of the addressed target, as the master does on STOP or an error
+static void release(sim_bus_t *b)
+{
+    if (b->sel && b->sel->stop) {
+        b->sel->stop(b->sel);
+    }
+    b->sel = NULL;
+}
+
+/**
+ * Run the load the driver put in a master's registers, up to the END token,
+ * the 16th token or the first token not acknowledged. The outcome is held back
+ * until simulated time reaches the end of the load.
+ */
+static void startLoad(int bus)
+{
+    sim_bus_t *b = &buses[bus];
+    volatile oc4_host_if_t *regs = oc4HostIf(bus);
+    uint64_t period = sclPeriod(regs);
+    uint64_t cycles = LOAD_OVERHEAD_CYCLES;
+    uint32_t wdata[2] = { regs->wdata0, regs->wdata1 };
+    uint8_t rd[8] = {0};
+    int rd_cnt = 0, wr_cnt = 0;
+    int err = 0, stretch = 0;
+    int tk_idx;
+
+    for (tk_idx = 0; tk_idx < 16; tk_idx++) {
+        uint32_t list = tk_idx < 8 ? regs->tk_list0 : regs->tk_list1;
+        uint32_t tk = (list >> ((tk_idx % 8) * 4)) & 0xF;
+        int reply = OC4_SIM_ACK;
+
+        if (tk == OC4_I2C_TK_END) {
+            break;
+        }
+        switch (tk) {
+            case OC4_I2C_TK_START:
+                cycles += START_PERIODS * period;
+                b->sel = NULL;
+                break;
+            case OC4_I2C_TK_ADDRW:
+            case OC4_I2C_TK_ADDRR:
+                cycles += BYTE_PERIODS * period;
+                b->reading = tk == OC4_I2C_TK_ADDRR;
+                b->sel = findTarget(b, (regs->addr >> 1) & 0x7F);
+                if (!b->sel) {
+                    reply = OC4_SIM_NACK;
+                } else if (b->sel->start) {
+                    reply = b->sel->start(b->sel, b->reading);
+                }
+                break;
+            case OC4_I2C_TK_DATA:
+            case OC4_I2C_TK_DATA_END:
+                cycles += BYTE_PERIODS * period;
+                if (!b->sel) {
+                    // Nothing addressed, so nothing drives ACK
+                    reply = OC4_SIM_NACK;
+                } else if (b->reading) {
+                    uint8_t byte = 0xFF;
+                    if (b->sel->read) {
+                        reply = b->sel->read(b->sel, tk == OC4_I2C_TK_DATA_END, &byte);
+                    }
+                    if (rd_cnt < 8) {
+                        rd[rd_cnt++] = byte;
+                    }
+                    b->stats.rd_bytes++;
+                } else {
+                    uint8_t byte = wdata[wr_cnt / 4] >> ((wr_cnt % 4) * 8);
+                    wr_cnt = (wr_cnt + 1) % 8;
+                    if (b->sel->write) {
+                        reply = b->sel->write(b->sel, byte);
+                    }
+                    b->stats.wr_bytes++;
+                }
+                break;
+            case OC4_I2C_TK_STOP:
+                cycles += STOP_PERIODS * period;
+                release(b);
+                break;
+            default:
+                // Reserved token values halt the list processor
+                reply = OC4_SIM_NACK;
+                break;
+        }
+
+        if (reply == OC4_SIM_STRETCH) {
+            stretch = 1;
+            break;
+        }
+        if (reply != OC4_SIM_ACK) {
+            err = 1;
+            b->stats.nacks++;
+            release(b);
+            break;
+        }
+    }
+
+    b->running = 1;
+    b->timeout = stretch;
+    b->stats.loads++;
+    if (stretch) {
+        b->stats.timeouts++;
+        release(b);
+        b->done_at = now + OC4_SIM_TIMEOUT_NS;
+        b->ctl = 0;
+    } else {
+        b->done_at = now + cyclesToNs(cycles);
+        b->ctl = ((uint32_t)rd_cnt << 8) | ((uint32_t)(tk_idx & 0xF) << 4) | (err ? REG_CTRL_ERROR : 0);
+    }
+    b->stats.busy_ns += b->done_at - now;
+    b->rdata[0] = 0;
+    b->rdata[1] = 0;
+    for (int i = 0; i < rd_cnt; i++) {
+        b->rdata[i / 4] |= (uint32_t)rd[i] << ((i % 4) * 8);
+    }
+
+    // The list processor is busy until the load ends
+    regs->ctl |= REG_CTRL_STATUS;
+}
+
+static void finishLoad(int bus)
+{
+    sim_bus_t *b = &buses[bus];
+    volatile oc4_host_if_t *regs = oc4HostIf(bus);
+    if (!b->timeout) {
+        regs->rdata0 = b->rdata[0];
+        regs->rdata1 = b->rdata[1];
+    }
+    regs->ctl = (regs->ctl & ~(REG_CTRL_START | REG_CTRL_STATUS | REG_CTRL_ERROR |
+                               REG_CTRL_CURR_TK | REG_CTRL_RD_CNT)) | b->ctl;
+    b->running = 0;
+}
+
+int oc4SimNext(void)
+{
+    int next = -1;
+    for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        sim_bus_t *b = &buses[bus];
+        if (!b->running && (oc4HostIf(bus)->ctl & REG_CTRL_START)) {
+            startLoad(bus);
+        }
+        if (b->running && (next < 0 || b->done_at < buses[next].done_at)) {
+            next = bus;
+        }
+    }
+    if (next < 0) {
+        return -1;
+    }
+
+    if (buses[next].done_at > now) {
+        __atomic_store_n(&now, buses[next].done_at, __ATOMIC_RELAXED);
+    }
+    int timeout = buses[next].timeout;
+    finishLoad(next);
+    return timeout ? irqs[next].irq_to : irqs[next].irq;
+}
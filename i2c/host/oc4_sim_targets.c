@@ -0,0 +1,175 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// oc4_sim_targets.c
+// Virtual i2c targets for the list processor model in oc4_sim.c: a DS3231 real
+// time clock, a 24Cxx EEPROM and the echo sketch in test/echo-mega2560.
+
+#include <stdlib.h>
+#include <string.h>
+#include "oc4-sim.h"
+
+// DS3231
+
+static int ds3231Start(oc4_sim_target_t *t, int read)
+{
+    sim_ds3231_t *dev = (sim_ds3231_t *)t;
+    dev->first = !read;
+    return OC4_SIM_ACK;
+}
+
+static int ds3231Write(oc4_sim_target_t *t, uint8_t byte)
+{
+    sim_ds3231_t *dev = (sim_ds3231_t *)t;
+    if (dev->first) {
+        dev->first = 0;
+        if (byte >= SIM_DS3231_REGS) {
+            return OC4_SIM_NACK;
+        }
+        dev->ptr = byte;
+        return OC4_SIM_ACK;
+    }
+    dev->regs[dev->ptr] = byte;
+    dev->ptr = (dev->ptr + 1) % SIM_DS3231_REGS;
+    return OC4_SIM_ACK;
+}
+
+static int ds3231Read(oc4_sim_target_t *t, int last, uint8_t *byte)
+{
+    sim_ds3231_t *dev = (sim_ds3231_t *)t;
+    *byte = dev->regs[dev->ptr];
+    dev->ptr = (dev->ptr + 1) % SIM_DS3231_REGS;
+    return OC4_SIM_ACK;
+}
+
+oc4_sim_target_t *simDs3231(sim_ds3231_t *dev, uint8_t addr)
+{
+    // 12:00:00 Monday 1 January 2024, in BCD
+    static const uint8_t reset[SIM_DS3231_REGS] = {
+        0x00, 0x00, 0x12, 0x01, 0x01, 0x01, 0x24, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x1C, 0x00, 0x00, 0x19, 0x00,
+    };
+    memset(dev, 0, sizeof(*dev));
+    memcpy(dev->regs, reset, sizeof(reset));
+    dev->t = (oc4_sim_target_t) {
+        .name = "ds3231",
+        .addr = addr,
+        .start = ds3231Start,
+        .write = ds3231Write,
+        .read = ds3231Read,
+    };
+    return &dev->t;
+}
+
+// 24Cxx EEPROM
+
+static int eepromStart(oc4_sim_target_t *t, int read)
+{
+    sim_eeprom_t *dev = (sim_eeprom_t *)t;
+    if (oc4SimNow() < dev->busy_until) {
+        // Still in the write cycle
+        return OC4_SIM_NACK;
+    }
+    dev->addr_left = read ? 0 : dev->addr_bytes;
+    dev->wrote = 0;
+    return OC4_SIM_ACK;
+}
+
+static int eepromWrite(oc4_sim_target_t *t, uint8_t byte)
+{
+    sim_eeprom_t *dev = (sim_eeprom_t *)t;
+    if (dev->addr_left) {
+        uint32_t hi = dev->addr_left == dev->addr_bytes ? 0 : dev->ptr << 8;
+        dev->ptr = (hi | byte) % dev->size;
+        dev->addr_left--;
+        return OC4_SIM_ACK;
+    }
+    dev->mem[dev->ptr] = byte;
+    uint32_t page = dev->ptr - dev->ptr % dev->page;
+    dev->ptr = page + (dev->ptr + 1) % dev->page;
+    dev->wrote = 1;
+    return OC4_SIM_ACK;
+}
+
+static int eepromRead(oc4_sim_target_t *t, int last, uint8_t *byte)
+{
+    sim_eeprom_t *dev = (sim_eeprom_t *)t;
+    *byte = dev->mem[dev->ptr];
+    dev->ptr = (dev->ptr + 1) % dev->size;
+    return OC4_SIM_ACK;
+}
+
+static void eepromStop(oc4_sim_target_t *t)
+{
+    sim_eeprom_t *dev = (sim_eeprom_t *)t;
+    if (dev->wrote) {
+        dev->busy_until = oc4SimNow() + SIM_EEPROM_TWR_NS;
+        dev->wrote = 0;
+    }
+}
+
+oc4_sim_target_t *simEeprom24(sim_eeprom_t *dev, uint8_t addr, uint32_t kbits)
+{
+    memset(dev, 0, sizeof(*dev));
+    dev->size = kbits * 128;
+    dev->mem = malloc(dev->size);
+    memset(dev->mem, 0xFF, dev->size);
+    dev->addr_bytes = kbits > 16 ? 2 : 1;
+    // 24C01/02 have 8 byte pages, up to 24C16 16 bytes, and 32 bytes above that
+    dev->page = kbits <= 2 ? 8 : kbits <= 16 ? 16 : 32;
+    dev->t = (oc4_sim_target_t) {
+        .name = "24cxx",
+        .addr = addr,
+        .start = eepromStart,
+        .write = eepromWrite,
+        .read = eepromRead,
+        .stop = eepromStop,
+    };
+    return &dev->t;
+}
+
+// Echo
+
+static int echoStart(oc4_sim_target_t *t, int read)
+{
+    sim_echo_t *dev = (sim_echo_t *)t;
+    if (read) {
+        dev->pos = 0;
+    } else {
+        dev->len = 0;
+    }
+    return OC4_SIM_ACK;
+}
+
+static int echoWrite(oc4_sim_target_t *t, uint8_t byte)
+{
+    sim_echo_t *dev = (sim_echo_t *)t;
+    if (dev->len == SIM_ECHO_BUF_SZ) {
+        return OC4_SIM_NACK;
+    }
+    dev->buf[dev->len++] = byte;
+    return OC4_SIM_ACK;
+}
+
+static int echoRead(oc4_sim_target_t *t, int last, uint8_t *byte)
+{
+    sim_echo_t *dev = (sim_echo_t *)t;
+    *byte = dev->pos < dev->len ? dev->buf[dev->pos++] : 0xFF;
+    return OC4_SIM_ACK;
+}
+
+oc4_sim_target_t *simEcho(sim_echo_t *dev, uint8_t addr)
+{
+    memset(dev, 0, sizeof(*dev));
+    dev->t = (oc4_sim_target_t) {
+        .name = "echo",
+        .addr = addr,
+        .start = echoStart,
+        .write = echoWrite,
+        .read = echoRead,
+    };
+    return &dev->t;
+}
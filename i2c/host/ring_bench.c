@@ -0,0 +1,235 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// ring_bench.c
+// Host benchmark suite for sw_shared_ringbuffer.h. A producer and a consumer
+// thread, pinned to separate cores where possible, move descriptors through a
+// single ring using either single or batched operations, for a range of ring
+// sizes. Reports throughput and the p50/p99 enqueue-to-dequeue latency of a
+// sample of descriptors.
+//
+// Usage: ring_bench [ops] [-c]
+//   ops  number of descriptors per run (default 2000000)
+//   -c   print CSV instead of a table
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sw_shared_ringbuffer.h"
+
+#define DEFAULT_OPS 2000000UL
+
+// Only every SAMPLE_EVERY'th descriptor is timestamped, to keep the clock
+// reads from dominating the numbers.
+#define SAMPLE_EVERY 16
+
+static const uint32_t ring_sizes[] = { 16, 64, 256, 1024, 4096 };
+static const unsigned int batch_sizes[] = { 1, 8, 32 };
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BATCH_MAX 32
+
+typedef struct {
+    ring_buffer_t *ring;
+    unsigned long ops;
+    unsigned int batch;
+    uint64_t *stamps;       // Enqueue time of sampled descriptors, indexed by sequence
+    uint64_t *latencies;    // Enqueue-to-dequeue time of sampled descriptors
+    unsigned long nlat;
+    int cpu;
+} bench_t;
+
+static int ncpus;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+    if (ncpus < 2) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % ncpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Spinning on a single CPU just burns the other thread's timeslice.
+static inline void relax(void)
+{
+    if (ncpus < 2) {
+        sched_yield();
+    }
+}
+
+static void *producer(void *arg)
+{
+    bench_t *b = arg;
+    pin(0);
+    uint32_t offsets[BATCH_MAX];
+    unsigned int lens[BATCH_MAX];
+
+    unsigned long seq = 0;
+    while (seq < b->ops) {
+        unsigned int n = b->batch;
+        if (n > b->ops - seq) {
+            n = b->ops - seq;
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            offsets[i] = seq + i;
+            lens[i] = 1;
+            if (!((seq + i) % SAMPLE_EVERY)) {
+                b->stamps[(seq + i) / SAMPLE_EVERY] = now_ns();
+            }
+        }
+
+        if (b->batch == 1) {
+            // enqueue complains on the debug console when full, so check first
+            while (ring_full(b->ring)) relax();
+            enqueue(b->ring, offsets[0], lens[0]);
+            seq++;
+        } else {
+            unsigned int done = 0;
+            while (done < n) {
+                unsigned int k = enqueue_batch(b->ring, offsets + done, lens + done, n - done);
+                if (!k) {
+                    relax();
+                }
+                done += k;
+            }
+            seq += n;
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    bench_t *b = arg;
+    pin(1);
+    uint32_t offsets[BATCH_MAX];
+    unsigned int lens[BATCH_MAX];
+
+    unsigned long seq = 0;
+    while (seq < b->ops) {
+        unsigned int n;
+        if (b->batch == 1) {
+            n = !dequeue(b->ring, offsets, lens);
+        } else {
+            n = dequeue_batch(b->ring, offsets, lens, b->batch);
+        }
+        if (!n) {
+            relax();
+            continue;
+        }
+        uint64_t t = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            if (offsets[i] != (uint32_t)(seq + i)) {
+                fprintf(stderr, "ring_bench: out of order descriptor %u, expected %lu\n",
+                        offsets[i], seq + i);
+                exit(1);
+            }
+            if (!((seq + i) % SAMPLE_EVERY)) {
+                if (!t) {
+                    t = now_ns();
+                }
+                b->latencies[b->nlat++] = t - b->stamps[(seq + i) / SAMPLE_EVERY];
+            }
+        }
+        seq += n;
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(uint32_t size, unsigned int batch, unsigned long ops, int csv)
+{
+    size_t bytes = RING_BUFFER_BYTES(size);
+    ring_buffer_t *ring = aligned_alloc(RING_CACHE_LINE, bytes);
+    ring_buffer_t *spare = aligned_alloc(RING_CACHE_LINE, bytes);
+    ring_handle_t handle;
+    ring_init(&handle, spare, ring, size, 1);
+
+    bench_t b = {
+        .ring = ring,
+        .ops = ops,
+        .batch = batch,
+        .stamps = calloc(ops / SAMPLE_EVERY + 1, sizeof(uint64_t)),
+        .latencies = calloc(ops / SAMPLE_EVERY + 1, sizeof(uint64_t)),
+    };
+
+    pthread_t tp, tc;
+    uint64_t start = now_ns();
+    pthread_create(&tc, NULL, consumer, &b);
+    pthread_create(&tp, NULL, producer, &b);
+    pthread_join(tp, NULL);
+    pthread_join(tc, NULL);
+    double elapsed = (now_ns() - start) / 1e9;
+
+    qsort(b.latencies, b.nlat, sizeof(uint64_t), cmp_u64);
+    uint64_t p50 = b.nlat ? b.latencies[b.nlat / 2] : 0;
+    uint64_t p99 = b.nlat ? b.latencies[(b.nlat * 99) / 100] : 0;
+
+    const char *mode = batch == 1 ? "single" : "batch";
+    if (csv) {
+        printf("%s,%u,%u,%.0f,%lu,%lu\n", mode, size, batch, ops / elapsed,
+               (unsigned long)p50, (unsigned long)p99);
+    } else {
+        printf("%-7s %6u %6u %14.0f %10lu %10lu\n", mode, size, batch, ops / elapsed,
+               (unsigned long)p50, (unsigned long)p99);
+    }
+
+    free(b.stamps);
+    free(b.latencies);
+    free(ring);
+    free(spare);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long ops = DEFAULT_OPS;
+    int csv = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c")) {
+            csv = 1;
+        } else {
+            ops = strtoul(argv[i], NULL, 0);
+        }
+    }
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (csv) {
+        printf("mode,ring_size,batch,ops_per_sec,p50_ns,p99_ns\n");
+    } else {
+        printf("ring benchmark: %lu ops per run, %d cpu(s)%s\n", ops, ncpus,
+               ncpus < 2 ? " - threads not pinned, latencies include scheduling" : "");
+        printf("%-7s %6s %6s %14s %10s %10s\n", "mode", "size", "batch", "ops/sec", "p50 ns", "p99 ns");
+    }
+    for (unsigned int s = 0; s < ARRAY_SIZE(ring_sizes); s++) {
+        for (unsigned int b = 0; b < ARRAY_SIZE(batch_sizes); b++) {
+            if (batch_sizes[b] > ring_sizes[s]) {
+                continue;
+            }
+            run(ring_sizes[s], batch_sizes[b], ops, csv);
+        }
+    }
+    return 0;
+}
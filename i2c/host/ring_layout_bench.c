@@ -0,0 +1,225 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// ring_layout_bench.c
+// Host benchmark comparing the original packed ring_buffer_t layout against the
+// cache-line-separated layout with shadowed indices. One producer and one
+// consumer thread are pinned to separate cores (when there are two) and pass
+// descriptors through a single ring. L1D read misses are sampled with
+// perf_event_open, which is the closest proxy we have for cross-core index
+// traffic on a host. If perf events are unavailable the column reads n/a.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "sw_shared_ringbuffer.h"
+
+#define DEFAULT_OPS 10000000UL
+#define LEGACY_SIZE 512
+
+// Original layout (16 byte descriptors, packed indices), kept here purely for comparison.
+typedef struct legacy_buff_desc {
+    uintptr_t encoded_addr;
+    unsigned int len;
+} legacy_buff_desc_t;
+
+typedef struct legacy_ring_buffer {
+    uint32_t write_idx;
+    uint32_t read_idx;
+    legacy_buff_desc_t buffers[LEGACY_SIZE];
+} legacy_ring_buffer_t;
+
+static inline int legacy_enqueue(legacy_ring_buffer_t *ring, uintptr_t buffer, unsigned int len)
+{
+    if (!((*(volatile uint32_t *)&ring->write_idx - *(volatile uint32_t *)&ring->read_idx + 1) % LEGACY_SIZE)) {
+        return -1;
+    }
+    ring->buffers[ring->write_idx % LEGACY_SIZE].encoded_addr = buffer;
+    ring->buffers[ring->write_idx % LEGACY_SIZE].len = len;
+    THREAD_MEMORY_RELEASE();
+    ring->write_idx++;
+    return 0;
+}
+
+static inline int legacy_dequeue(legacy_ring_buffer_t *ring, uintptr_t *addr, unsigned int *len)
+{
+    if (!((*(volatile uint32_t *)&ring->write_idx - *(volatile uint32_t *)&ring->read_idx) % LEGACY_SIZE)) {
+        return -1;
+    }
+    THREAD_MEMORY_ACQUIRE();
+    *addr = ring->buffers[ring->read_idx % LEGACY_SIZE].encoded_addr;
+    *len = ring->buffers[ring->read_idx % LEGACY_SIZE].len;
+    THREAD_MEMORY_RELEASE();
+    ring->read_idx++;
+    return 0;
+}
+
+typedef struct {
+    int legacy;
+    void *ring;
+    unsigned long ops;
+    int cpu;
+    long long misses;
+    unsigned long checksum;
+} bench_thread_t;
+
+static int ncpus;
+
+static void pin(int cpu)
+{
+    if (ncpus < 2) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % ncpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Spinning on a single CPU just burns the other thread's timeslice.
+static inline void relax(void)
+{
+    if (ncpus < 2) {
+        sched_yield();
+    }
+}
+
+static int perf_open(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long perf_close(int fd)
+{
+    long long count = -1;
+    if (fd < 0) {
+        return -1;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        count = -1;
+    }
+    close(fd);
+    return count;
+}
+
+static void *producer(void *arg)
+{
+    bench_thread_t *t = arg;
+    pin(t->cpu);
+    int fd = perf_open();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    for (unsigned long i = 0; i < t->ops; i++) {
+        if (t->legacy) {
+            while (legacy_enqueue(t->ring, i, 1)) relax();
+        } else {
+            while (ring_full(t->ring)) relax();
+            enqueue(t->ring, i, 1);
+        }
+    }
+    t->misses = perf_close(fd);
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    bench_thread_t *t = arg;
+    pin(t->cpu);
+    int fd = perf_open();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uintptr_t addr;
+    uint32_t offset;
+    unsigned int len;
+    for (unsigned long i = 0; i < t->ops; i++) {
+        if (t->legacy) {
+            while (legacy_dequeue(t->ring, &addr, &len)) relax();
+            t->checksum += addr;
+        } else {
+            while (dequeue(t->ring, &offset, &len)) relax();
+            t->checksum += offset;
+        }
+    }
+    t->misses = perf_close(fd);
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int legacy, unsigned long ops)
+{
+    size_t bytes = legacy ? sizeof(legacy_ring_buffer_t) : RING_BUFFER_BYTES(LEGACY_SIZE);
+    void *mem = aligned_alloc(RING_CACHE_LINE, bytes);
+    void *spare = aligned_alloc(RING_CACHE_LINE, bytes);
+    memset(mem, 0, bytes);
+    if (!legacy) {
+        ring_handle_t handle;
+        ring_init(&handle, mem, spare, LEGACY_SIZE, 1);
+    }
+
+    bench_thread_t prod = { .legacy = legacy, .ring = mem, .ops = ops, .cpu = 0 };
+    bench_thread_t cons = { .legacy = legacy, .ring = mem, .ops = ops, .cpu = 1 };
+    pthread_t tp, tc;
+
+    double start = now();
+    pthread_create(&tc, NULL, consumer, &cons);
+    pthread_create(&tp, NULL, producer, &prod);
+    pthread_join(tp, NULL);
+    pthread_join(tc, NULL);
+    double elapsed = now() - start;
+
+    unsigned long expect = ops * (ops - 1) / 2;
+    printf("%-8s %12.0f ", legacy ? "packed" : "split", ops / elapsed);
+    if (prod.misses >= 0 && cons.misses >= 0) {
+        printf("%14.3f", (double)(prod.misses + cons.misses) / ops);
+    } else {
+        printf("%14s", "n/a");
+    }
+    printf("   %s\n", cons.checksum == expect ? "ok" : "CORRUPT");
+    free(mem);
+    free(spare);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long ops = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_OPS;
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("ring layout benchmark: %lu ops, %d cpu(s)%s\n", ops, ncpus,
+           ncpus < 2 ? " - threads not pinned, cross-core effects will not show" : "");
+    printf("%-8s %12s %14s\n", "layout", "ops/sec", "L1D miss/op");
+    run(1, ops);
+    run(0, ops);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// sel4cp_host.c
+// Host implementation of the libsel4cp channel and message register calls
+// declared in include/sel4cp.h. Notifications and IRQ acks go to optional hooks
+// set by the harness. Message registers are a plain array, so a harness can set
+// them up before calling a PD's protected() and read back what it left there.
+
+#include <sel4cp.h>
+
+void (*sel4cp_host_notify_hook)(sel4cp_channel ch);
+void (*sel4cp_host_irq_ack_hook)(sel4cp_channel ch);
+unsigned long sel4cp_host_notifies;
+unsigned long sel4cp_host_irq_acks;
+
+static seL4_Word mrs[SEL4CP_HOST_MRS];
+
+// Counted atomically, as PDs may run on threads of their own (see sys_host.c)
+void sel4cp_notify(sel4cp_channel ch)
+{
+    __atomic_fetch_add(&sel4cp_host_notifies, 1, __ATOMIC_RELAXED);
+    if (sel4cp_host_notify_hook) {
+        sel4cp_host_notify_hook(ch);
+    }
+}
+
+void sel4cp_irq_ack(sel4cp_channel ch)
+{
+    __atomic_fetch_add(&sel4cp_host_irq_acks, 1, __ATOMIC_RELAXED);
+    if (sel4cp_host_irq_ack_hook) {
+        sel4cp_host_irq_ack_hook(ch);
+    }
+}
+
+seL4_Word sel4cp_mr_get(uint8_t mr)
+{
+    return mr < SEL4CP_HOST_MRS ? mrs[mr] : 0;
+}
+
+void sel4cp_mr_set(uint8_t mr, seL4_Word value)
+{
+    if (mr < SEL4CP_HOST_MRS) {
+        mrs[mr] = value;
+    }
+}
+
+// Same layout as seL4: label in the top bits, length in the bottom 7
+seL4_MessageInfo_t sel4cp_msginfo_new(seL4_Word label, uint16_t count)
+{
+    return (seL4_MessageInfo_t) {{ (label << 12) | (count & 0x7f) }};
+}
+
+seL4_Word sel4cp_msginfo_get_label(seL4_MessageInfo_t msginfo)
+{
+    return msginfo.words[0] >> 12;
+}
+
+// printf of SEL4CP_HOST_QUIET builds. Out of line, so the arguments are still
+// worked out as in the real build.
+int sel4cp_host_quiet_printf(const char *format, ...)
+{
+    return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// sys_host.c
+// Host stand-in for i2c.system. See include/sys-host.h.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sys-host.h"
+#include "oc4-host.h"
+#include "oc4-sim.h"
+#include "i2c-driver.h"
+#include "i2c-transport.h"
+#include "i2c.h"
+
+#define PD_SERVER 0
+#define PD_DRIVER 1
+#define PD_NONE 2
+
+static const int priority[] = {
+    [PD_SERVER] = 200,
+    [PD_DRIVER] = 201,
+    [PD_NONE] = -1,
+};
+
+// Channels with a notification waiting, per PD. Set by whichever thread
+// notifies, so always updated atomically.
+static uint64_t pending[2];
+// PD the calling thread is running
+static __thread int current = PD_NONE;
+
+// Threaded mode: the driver runs on a thread of its own and each PD sleeps on
+// its condition variable until notified
+static int threaded;
+static int stopping;
+static pthread_t driver_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake[2] = { PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static inline uint64_t pendingOf(int pd)
+{
+    return __atomic_load_n(&pending[pd], __ATOMIC_ACQUIRE);
+}
+
+static void runPd(int pd)
+{
+    int prev = current;
+    current = pd;
+    uint64_t bits;
+    while ((bits = pendingOf(pd))) {
+        sel4cp_channel ch = __builtin_ctzll(bits);
+        __atomic_fetch_and(&pending[pd], ~(1ULL << ch), __ATOMIC_ACQ_REL);
+        if (pd == PD_DRIVER) {
+            driver_notified(ch);
+        } else {
+            server_notified(ch);
+        }
+    }
+    current = prev;
+}
+
+static void post(int pd, sel4cp_channel ch)
+{
+    __atomic_fetch_or(&pending[pd], 1ULL << ch, __ATOMIC_RELEASE);
+    if (threaded) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&wake[pd]);
+        pthread_mutex_unlock(&lock);
+    } else if (priority[pd] > priority[current]) {
+        runPd(pd);
+    }
+}
+
+// The one channel of i2c.system between the two PDs
+static void onNotify(sel4cp_channel ch)
+{
+    if (current == PD_SERVER && ch == DRIVER_NOTIFY_ID) {
+        post(PD_DRIVER, SERVER_NOTIFY_ID);
+    } else if (current == PD_DRIVER && ch == SERVER_NOTIFY_ID) {
+        post(PD_SERVER, DRIVER_NOTIFY_ID);
+    } else {
+        fprintf(stdout, "sys_host: notify on unknown channel %u\n", ch);
+        exit(1);
+    }
+}
+
+void sysHostInit(void)
+{
+    oc4HostInit();
+    sel4cp_host_notify_hook = onNotify;
+    pending[PD_SERVER] = 0;
+    pending[PD_DRIVER] = 0;
+
+    current = PD_DRIVER;
+    driver_init();
+    current = PD_SERVER;
+    server_init();
+    current = PD_NONE;
+}
+
+int sysHostSubmit(int bus, const uint8_t *tokens, size_t len, uint8_t client, uint8_t addr)
+{
+    int prev = current;
+    current = PD_SERVER;
+    int err = allocReqBuf(bus, len, (uint8_t *)tokens, client, addr);
+    if (!err && reqBufNeedsNotify(bus)) {
+        sel4cp_notify(DRIVER_NOTIFY_ID);
+    }
+    current = prev;
+    return err;
+}
+
+int sysHostStep(void)
+{
+    if (threaded) {
+        pthread_mutex_lock(&lock);
+        while (!pendingOf(PD_SERVER)) {
+            pthread_cond_wait(&wake[PD_SERVER], &lock);
+        }
+        pthread_mutex_unlock(&lock);
+        runPd(PD_SERVER);
+        return 0;
+    }
+    if (pendingOf(PD_DRIVER)) {
+        runPd(PD_DRIVER);
+        return 0;
+    }
+    if (pendingOf(PD_SERVER)) {
+        runPd(PD_SERVER);
+        return 0;
+    }
+    int ch = oc4SimNext();
+    if (ch < 0) {
+        return -1;
+    }
+    __atomic_fetch_or(&pending[PD_DRIVER], 1ULL << ch, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void sysHostRun(void)
+{
+    while (!sysHostStep());
+}
+
+// The driver PD: its notifications first, then whatever load ends next
+static void *driverThread(void *arg)
+{
+    int cpu = *(int *)arg;
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    current = PD_DRIVER;
+    for (;;) {
+        if (pendingOf(PD_DRIVER)) {
+            runPd(PD_DRIVER);
+            continue;
+        }
+        int ch = oc4SimNext();
+        if (ch >= 0) {
+            __atomic_fetch_or(&pending[PD_DRIVER], 1ULL << ch, __ATOMIC_RELEASE);
+            continue;
+        }
+        pthread_mutex_lock(&lock);
+        while (!pendingOf(PD_DRIVER) && !stopping) {
+            pthread_cond_wait(&wake[PD_DRIVER], &lock);
+        }
+        int stop = stopping && !pendingOf(PD_DRIVER);
+        pthread_mutex_unlock(&lock);
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+void sysHostStartThreads(int driver_cpu)
+{
+    static int cpu;
+    cpu = driver_cpu;
+    stopping = 0;
+    threaded = 1;
+    current = PD_SERVER;
+    if (pthread_create(&driver_thread, NULL, driverThread, &cpu)) {
+        fprintf(stdout, "sys_host: failed to start the driver thread\n");
+        exit(1);
+    }
+}
+
+void sysHostStopThreads(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&wake[PD_DRIVER]);
+    pthread_mutex_unlock(&lock);
+    pthread_join(driver_thread, NULL);
+    threaded = 0;
+    current = PD_NONE;
+}
@@ -17,6 +17,7 @@
 #include "i2c.h"
 #include "odroidc4-i2c-mem.h"
 #include "i2c-transport.h"
+#include "i2c-prog.h"
 #include "gpio.h"
 #include "clk.h"
 #include <stdint.h>
@@ -39,11 +40,107 @@ uintptr_t i2c;
 uintptr_t gpio;
 uintptr_t clk;
 
-// Actual interfaces. Note that address here must match the one in i2c.system defined for `i2c` memory region.
-// Hardcoded because the C compiler cannot handle the non-constant symbol `uinptr_t i2c`, which is added by the
-// elf patcher.
-volatile i2c_if_t *if_m2 = (void *)(uintptr_t)(0x3000000 + 0x1000);
-volatile i2c_if_t *if_m3 = (void *)(uintptr_t)(0x3000000);
+// Offset of each master's registers in the `i2c` region. The masters sit 0x1000
+// apart, M3 first. The region base is only known once the elf patcher has set
+// `i2c`, so it is added at run time (see i2cRegs). A per-bus driver only maps
+// its own master's page.
+#ifdef I2C_DRIVER_BUS
+#define I2C_IF_OFFSET(m) 0
+#else
+#define I2C_IF_OFFSET(m) ((3 - (m)) * 0x1000)
+#endif
+
+// Static description of each EE master interface
+typedef struct i2c_ifDesc {
+    uint32_t regs;              // Offset of the interface registers in `i2c`
+    sel4cp_channel irq;         // Completion IRQ channel
+    sel4cp_channel irq_to;      // Timeout IRQ channel
+    uint32_t pinmux_reg;        // Pinmux register for the SDA/SCL pads
+    uint32_t pinmux_mask;       // SDA/SCL fields of that register
+    uint32_t pinmux;            // i2c function in those fields
+    uint32_t ds_reg;            // Drive strength register, 0 to leave the pads at reset strength
+    uint32_t ds_mask;           // SDA/SCL fields of that register
+    uint32_t ds;                // Drive strength in those fields
+    uint32_t bias_reg;          // Pull enable register for the pads
+    uint32_t bias_mask;         // SDA/SCL bits of that register
+} i2c_ifDesc_t;
+
+// Interfaces indexed by bus. Only those with transport rings are brought up.
+static const i2c_ifDesc_t i2c_ifDesc[I2C_NUM_BUSES] = {
+    [0] = {
+        .regs = I2C_IF_OFFSET(0),
+        .irq = IRQ_I2C_M0,
+        .irq_to = IRQ_I2C_M0_TO,
+        .pinmux_reg = GPIO_PINMUX_6,
+        .pinmux_mask = GPIO_PM6_Z0 | GPIO_PM6_Z1,
+        .pinmux = (GPIO_PM6_Z_I2C << 0) | (GPIO_PM6_Z_I2C << 4),
+        .bias_reg = GPIO_BIAS_4_EN,
+        .bias_mask = BIT(0) | BIT(1),      // z0 and z1
+    },
+    [1] = {
+        .regs = I2C_IF_OFFSET(1),
+        .irq = IRQ_I2C_M1,
+        .irq_to = IRQ_I2C_M1_TO,
+        .pinmux_reg = GPIO_PINMUX_4,
+        .pinmux_mask = GPIO_PM4_X10 | GPIO_PM4_X11,
+        .pinmux = (GPIO_PM4_X_I2C << 8) | (GPIO_PM4_X_I2C << 12),
+        .bias_reg = GPIO_BIAS_2_EN,
+        .bias_mask = BIT(10) | BIT(11),    // x10 and x11
+    },
+    [2] = {
+        .regs = I2C_IF_OFFSET(2),
+        .irq = IRQ_I2C_M2,
+        .irq_to = IRQ_I2C_M2_TO,
+        .pinmux_reg = GPIO_PINMUX_5,
+        .pinmux_mask = GPIO_PM5_X17 | GPIO_PM5_X18,
+        .pinmux = (GPIO_PM5_X_I2C << 4) | (GPIO_PM5_X_I2C << 8),
+        .ds_reg = GPIO_DS_2B,
+        .ds_mask = GPIO_DS_2B_X17 | GPIO_DS_2B_X18,
+        .ds = (3 << GPIO_DS_2B_X17_SHIFT) | (3 << GPIO_DS_2B_X18_SHIFT),   // 3 mA
+        .bias_reg = GPIO_BIAS_2_EN,
+        .bias_mask = BIT(17) | BIT(18),    // x17 and x18
+    },
+    [3] = {
+        .regs = I2C_IF_OFFSET(3),
+        .irq = IRQ_I2C_M3,
+        .irq_to = IRQ_I2C_M3_TO,
+        .pinmux_reg = GPIO_PINMUX_E,
+        .pinmux_mask = GPIO_PE_A14 | GPIO_PE_A15,
+        .pinmux = (GPIO_PE_A_I2C << 24) | (GPIO_PE_A_I2C << 28),
+        .ds_reg = GPIO_DS_5A,
+        .ds_mask = GPIO_DS_5A_A14 | GPIO_DS_5A_A15,
+        .ds = (3 << GPIO_DS_5A_A14_SHIFT) | (3 << GPIO_DS_5A_A15_SHIFT),   // 3 mA
+        .bias_reg = GPIO_BIAS_5_EN,
+        .bias_mask = BIT(14) | BIT(15),    // a14 and a15
+    },
+};
+
+static inline volatile i2c_if_t *i2cRegs(int bus) {
+    return (volatile i2c_if_t *)(i2c + i2c_ifDesc[bus].regs);
+}
+
+// Building with -DI2C_DRIVER_BUS=n gives a driver PD that services bus n alone
+// (see i2c_per_bus.system). Otherwise one driver services every bus.
+#ifdef I2C_DRIVER_BUS
+_Static_assert(I2C_DRIVER_BUS >= 0 && I2C_DRIVER_BUS < I2C_NUM_BUSES, "I2C_DRIVER_BUS out of range");
+#define driverOwnsBus(bus) ((bus) == I2C_DRIVER_BUS)
+#else
+#define driverOwnsBus(bus) 1
+#endif
+
+// Building with -DI2C_DRIVER_PADS instead gives the i2c_pads PD, which only sets
+// up the shared pads and clock for the per-bus drivers and then signals them.
+#if defined(I2C_DRIVER_PADS) && defined(I2C_DRIVER_BUS)
+#error "I2C_DRIVER_PADS and I2C_DRIVER_BUS are separate PDs"
+#endif
+
+/**
+ * Whether this driver instance runs a bus: it must both own it and have
+ * transport rings for it.
+*/
+static inline int busActive(int bus) {
+    return driverOwnsBus(bus) && i2cBusEnabled(bus);
+}
 
 
 // Driver state
@@ -51,12 +148,31 @@ typedef struct _i2c_ifState {
     req_buf_ptr_t current_req; // Pointer to current request.
     ret_buf_ptr_t current_ret; // Pointer to current return buf.
     int current_req_len;        // Number of bytes in current request.
-    size_t remaining;              // Number of bytes remaining to dispatch.
-    int notified;               // Flag indicating that there is more work waiting.
-    int ddr;                    // Data direction. 0 = write, 1 = read.
+    size_t remaining;              // Loads of the list processor left for this request.
+    i2c_enc_t enc;              // Encoder position in the current request
+    uint32_t addr_base;         // Address register with the target address field clear
+    const volatile i2c_prog_t *prog;    // Compiled program being run, if any
+    size_t ret_len;             // Bytes of read data in current_ret so far
+    size_t ret_cap;             // Bytes of read data current_ret can hold
+    int prog_chunk;             // Index of next chunk of prog to load
+    req_buf_ptr_t backlog[I2C_BATCH_MAX];   // Requests popped from the server but not yet started
+    size_t backlog_sz[I2C_BATCH_MAX];       // Sizes of the above
+    int backlog_head;           // Index of next request to start in backlog
+    int backlog_count;          // Number of requests waiting in backlog
 } i2c_ifState_t;
 
 
+// Debug output. Register dumps read every interface register back over device
+// memory and each line goes out over the UART, so both are left out of the
+// transaction path unless the driver is built with -DI2C_DEBUG.
+#ifdef I2C_DEBUG
+#define i2cDebug(...) printf(__VA_ARGS__)
+#define i2cDebugDump(interface) i2cDump(interface)
+#else
+#define i2cDebug(...) do {} while (0)
+#define i2cDebugDump(interface) do {} while (0)
+#endif
+
 static inline int i2cDump(i2c_if_t *interface) {
     printf("i2c: dumping interface state...\n");
     
@@ -122,191 +238,224 @@ static inline int i2cDump(i2c_if_t *interface) {
 }
 
 // Driver state for each interface
-volatile i2c_ifState_t i2c_ifState[4];
-
-
-/**
- * Initialise the i2c master interfaces.
-*/
-static inline void setupi2c(void) {
-    printf("driver: initialising i2c master interfaces...\n");
-    // Set up pinmux
-    volatile uint32_t *gpio_mem = (void*)(gpio + GPIO_OFFSET);
-
-    volatile uint32_t *pinmux5_ptr      = ((void*)gpio_mem + GPIO_PINMUX_5*4);
-    volatile uint32_t *pinmuxE_ptr      = ((void*)gpio_mem + GPIO_PINMUX_E*4);
-    volatile uint32_t *pad_ds2b_ptr     = ((void*)gpio_mem + GPIO_DS_2B*4);
-    volatile uint32_t *pad_ds5a_ptr     = ((void*)gpio_mem + GPIO_DS_5A*4);
-    volatile uint32_t *pad_bias2_ptr    = ((void*)gpio_mem + GPIO_BIAS_2_EN*4);
-    volatile uint32_t *pad_bias5_ptr    = ((void*)gpio_mem + GPIO_BIAS_5_EN*4);
-    volatile uint32_t *clk81_ptr        = ((void*)clk + I2C_CLK_OFFSET);
-    // printf("Pointers set: \npinmux5_ptr%p\npinmuxE_ptr%p\npad_ds2b_ptr%p\npad_ds5a_ptr%p\npad_bias2_ptr%p\npad_bias5_ptr%p\nclk81_ptr%p\nif_m2%p\nif_m3%p\ngpio%p\n", pinmux5_ptr, pinmuxE_ptr, pad_ds2b_ptr, pad_ds5a_ptr, pad_bias2_ptr, pad_bias5_ptr, clk81_ptr, if_m2, if_m3, gpio_mem);
-    // Read existing register values
-    uint32_t pinmux5 = *pinmux5_ptr;
-    uint32_t pinmuxE = *pinmuxE_ptr;
-    uint32_t clk81 = *clk81_ptr;
-
-    // Enable i2cm2 -> pinmux 5
-    uint8_t pinfunc = GPIO_PM5_X_I2C;
-    pinmux5 |= (pinfunc << 4) | (pinfunc << 8);
-    *pinmux5_ptr = pinmux5;
+volatile i2c_ifState_t i2c_ifState[I2C_NUM_BUSES];
+
+// Clock configuration for each interface
+i2c_bus_t i2c_bus[I2C_NUM_BUSES];
+
+// Hybrid polling budget for each interface, in reads of the control register
+static const uint32_t i2c_pollBudget[I2C_NUM_BUSES] = {
+    I2C_M0_POLL_BUDGET, I2C_M1_POLL_BUDGET, I2C_M2_POLL_BUDGET, I2C_M3_POLL_BUDGET
+};
+
+// Cycle counter profiling of time-to-START: from entering i2cLoadTokens to the
+// start bit being set. Build with -DI2C_PROFILE to enable. Uses PMCCNTR_EL0, which
+// needs the kernel to export the PMU to user level, or the generic timer with
+// -DI2C_PROFILE_CNTVCT.
+#ifdef I2C_PROFILE
+#ifndef I2C_PROFILE_REPORT
+#define I2C_PROFILE_REPORT 256      // Loads between reports
+#endif
+
+typedef struct i2c_profile {
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint32_t count;
+} i2c_profile_t;
+
+static i2c_profile_t i2c_profile[I2C_NUM_BUSES];
+
+static inline uint64_t i2cCycles(void) {
+#if defined(__aarch64__) && defined(I2C_PROFILE_CNTVCT)
+    uint64_t v;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("isb; mrs %0, pmccntr_el0" : "=r"(v));
+    return v;
+#elif defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
 
-    // Enable i2cm3 -> pinmux E
-    pinfunc = GPIO_PE_A_I2C;
-    pinmuxE |= (pinfunc << 24) | (pinfunc << 28);
-    *pinmuxE_ptr = pinmuxE;
+static inline uint64_t i2cProfileStart(void) {
+    return i2cCycles();
+}
 
-    // Check that registers actually changed
-    if (!(*pinmux5_ptr & (GPIO_PM5_X18 | GPIO_PM5_X17))) {
-        printf("driver: failed to set pinmux5!\n");
+static inline void i2cProfileEnd(int bus, uint64_t t0) {
+    uint64_t dt = i2cCycles() - t0;
+    i2c_profile_t *p = &i2c_profile[bus];
+    if (!p->count || dt < p->min) {
+        p->min = dt;
+    }
+    if (dt > p->max) {
+        p->max = dt;
     }
-    if (!(*pinmuxE_ptr & (GPIO_PE_A15 | GPIO_PE_A14))) {
-        printf("driver: failed to set pinmuxE!\n");
+    p->total += dt;
+    p->count++;
+    if (p->count == I2C_PROFILE_REPORT) {
+        printf("i2c: bus %d time-to-START over %u loads: avg %lu min %lu max %lu cycles\n", bus,
+               p->count, (unsigned long) (p->total / p->count), (unsigned long) p->min,
+               (unsigned long) p->max);
+        *p = (i2c_profile_t) {0};
     }
+}
+#else
+static inline uint64_t i2cProfileStart(void) {
+    return 0;
+}
 
-    // Set GPIO drive strength
-    // m2
-    uint8_t ds = 3;    // 3 mA
-    *pad_ds2b_ptr &= ~(GPIO_DS_2B_X17 | GPIO_DS_2B_X18);
-    *pad_ds2b_ptr |= ((ds << GPIO_DS_2B_X17_SHIFT) | 
-                     (ds << GPIO_DS_2B_X18_SHIFT));
-    // m3
-    *pad_ds5a_ptr &= ~(GPIO_DS_5A_A14 | GPIO_DS_5A_A15);
-    *pad_ds5a_ptr |= ((ds << GPIO_DS_5A_A14_SHIFT) | 
-                     (ds << GPIO_DS_5A_A15_SHIFT));
+static inline void i2cProfileEnd(int bus, uint64_t t0) {}
+#endif
 
 
-    // Check register updated
-    if ((*pad_ds2b_ptr & (GPIO_DS_2B_X17 | GPIO_DS_2B_X18)) != ((ds << GPIO_DS_2B_X17_SHIFT) | 
-                     (ds << GPIO_DS_2B_X18_SHIFT))) {
-        printf("driver: failed to set drive strength for m2!\n");
-    }
-    if ((*pad_ds5a_ptr & (GPIO_DS_5A_A14 | GPIO_DS_5A_A15)) != ((ds << GPIO_DS_5A_A14_SHIFT) | 
-                     (ds << GPIO_DS_5A_A15_SHIFT))) {
-        printf("driver: failed to set drive strength for m3!\n");
-    }
+#ifndef I2C_DRIVER_BUS
+// Buses whose pads this PD routes: every configured bus for the i2c_pads PD,
+// which has no rings mapped, otherwise the buses this driver runs.
+#ifdef I2C_DRIVER_PADS
+#define padsOwnBus(bus) i2cBusConfigured(bus)
+#else
+#define padsOwnBus(bus) busActive(bus)
+#endif
 
-    // Disable bias, because the odroid i2c hardware has undocumented internal ones
-    *pad_bias2_ptr &= ~((1 << 18) | (1 << 17)); // Disable m2 bias - x17 and x18
-    *pad_bias5_ptr &= ~((1 << 14) | (1 << 15)); // Disable m3 bias - a14 and a15
+/**
+ * Route the pads of the i2c masters and ungate their clock. The bias registers
+ * and clk81 are shared between masters, so exactly one PD does this: the single
+ * driver, or the i2c_pads PD when there is a driver per bus.
+*/
+static inline void setupPads(void) {
+    printf("driver: initialising i2c pads and clock...\n");
+    volatile uint32_t *gpio_mem = (void*)(gpio + GPIO_OFFSET);
+    volatile uint32_t *clk81_ptr = ((void*)clk + I2C_CLK_OFFSET);
 
-    // Check registers updated
-    if ((*pad_bias2_ptr & ((1 << 18) | (1 << 17))) != 0) {
-        printf("driver: failed to disable bias for m2!\n");
-    }
-    if ((*pad_bias5_ptr & ((1 << 14) | (1 << 15))) != 0) {
-        printf("driver: failed to disable bias for m3!\n");
-    }
+    for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        if (!padsOwnBus(bus)) {
+            continue;
+        }
+        const i2c_ifDesc_t *desc = &i2c_ifDesc[bus];
+        volatile uint32_t *pinmux_ptr = ((void*)gpio_mem + desc->pinmux_reg*4);
+        volatile uint32_t *pad_ds_ptr = ((void*)gpio_mem + desc->ds_reg*4);
+        volatile uint32_t *pad_bias_ptr = ((void*)gpio_mem + desc->bias_reg*4);
+
+        // Route the pads to the i2c function
+        *pinmux_ptr = (*pinmux_ptr & ~desc->pinmux_mask) | desc->pinmux;
+        if ((*pinmux_ptr & desc->pinmux_mask) != desc->pinmux) {
+            printf("driver: failed to set pinmux for m%d!\n", bus);
+        }
+
+        // Set GPIO drive strength
+        if (desc->ds_reg) {
+            *pad_ds_ptr = (*pad_ds_ptr & ~desc->ds_mask) | desc->ds;
+            if ((*pad_ds_ptr & desc->ds_mask) != desc->ds) {
+                printf("driver: failed to set drive strength for m%d!\n", bus);
+            }
+        }
 
-    // Enable i2c by removing clock gate
-    clk81 |= (I2C_CLK81_BIT);
-    *clk81_ptr = clk81;
+        // Disable bias, because the odroid i2c hardware has undocumented internal ones.
+        // M1 and M2 share this register.
+        *pad_bias_ptr &= ~desc->bias_mask;
+        if (*pad_bias_ptr & desc->bias_mask) {
+            printf("driver: failed to disable bias for m%d!\n", bus);
+        }
+    }
 
-    // Check that registers actually changed
+    // Enable i2c by removing clock gate. All masters share clk81.
+    *clk81_ptr |= (I2C_CLK81_BIT);
     if (!(*clk81_ptr & I2C_CLK81_BIT)) {
         printf("driver: failed to toggle clock!\n");
     }
-    if (!(*pinmux5_ptr & (GPIO_PM5_X18 | GPIO_PM5_X17))) {
-        printf("driver: failed to set pinmux5!\n");
-    }
-
-
-    // Initialise fields
-    if_m2->ctl = if_m2->ctl & ~(REG_CTRL_MANUAL);   // Disable manual mode
-    if_m3->ctl = if_m3->ctl & ~(REG_CTRL_MANUAL);
-    if_m2->ctl = if_m2->ctl & ~(REG_CTRL_ACK_IGNORE);   // Disable ACK IGNORE
-    if_m3->ctl = if_m3->ctl & ~(REG_CTRL_ACK_IGNORE);
-    if_m2->ctl = if_m2->ctl | (REG_CTRL_CNTL_JIC);      // Bypass dynamic clock gating
-    if_m3->ctl = if_m3->ctl | (REG_CTRL_CNTL_JIC);
-
-    // Handle clocking
-    // Stolen from Linux Kernel's amlogic driver
-    /*
-    * According to I2C-BUS Spec 2.1, in FAST-MODE, LOW period should be at
-    * least 1.3uS, and HIGH period should be at lease 0.6. HIGH to LOW
-    * ratio as 2 to 5 is more safe.
-    * Duty  = H/(H + L) = 2/5	-- duty 40%%   H/L = 2/3
-    * Fast Mode : 400k
-    * High Mode : 3400k
-    */
-    // const uint32_t clk_rate = 166666666; // 166.666MHz -> clk81
-    // const uint32_t freq = 400000; // 400kHz
-    // const uint32_t delay_adjust = 0;
-    // uint32_t div_temp = (clk_rate * 2)/(freq * 5);
-	// uint32_t div_h = div_temp - delay_adjust;
-	// uint32_t div_l = (clk_rate * 3)/(freq * 10);
-
-    // Duty cycle slightly high with this - should adjust (47% instead of 40%)
-    // TODO: add clock driver logic here to dynamically set speed. This is a hack.
-    //       The below values allow us to be a spec compliant 400KHz controller w/
-    //       duty cycle, and high/low time appropriate
-    uint32_t div_h = 154;
-    uint32_t div_l = 116;
-
-    if_m2->ctl &= ~(REG_CTRL_CLKDIV_MASK);
-    if_m3->ctl &= ~(REG_CTRL_CLKDIV_MASK);
-    if_m2->ctl |= (div_h << REG_CTRL_CLKDIV_SHIFT);
-    if_m3->ctl |= (div_h << REG_CTRL_CLKDIV_SHIFT);
-
-    // Set SCL filtering
-    if_m2->addr &= ~(REG_ADDR_SCLFILTER);
-    if_m3->addr &= ~(REG_ADDR_SCLFILTER);
-    if_m2->addr |= (0x0 << 11);
-    if_m3->addr |= (0x0 << 11);
-
-    // Set SDA filtering
-    if_m2->addr &= ~(REG_ADDR_SDAFILTER);
-    if_m3->addr &= ~(REG_ADDR_SDAFILTER);
-    if_m2->addr |= (0x0 << 8);
-    if_m3->addr |= (0x0 << 8);
-
-    // Set clock delay levels
-    // Field has 9 bits: clear then shift in div_l
-    if_m2->addr &= ~(0x1FF << REG_ADDR_SCLDELAY_SHFT);
-    if_m3->addr &= ~(0x1FF << REG_ADDR_SCLDELAY_SHFT);
-    if_m2->addr |= (div_l << REG_ADDR_SCLDELAY_SHFT);
-    if_m3->addr |= (div_l << REG_ADDR_SCLDELAY_SHFT);
-
-    // Enable low delay time adjustment
-    if_m2->addr |= REG_ADDR_SCLDELAY_ENABLE;
-    if_m3->addr |= REG_ADDR_SCLDELAY_ENABLE;
+}
+#endif
+
+/**
+ * Initialise the registers of a master interface. Its pads must already be
+ * routed and its clock ungated.
+*/
+static inline void setupMaster(int bus) {
+    volatile i2c_if_t *interface = i2cRegs(bus);
+    interface->ctl = interface->ctl & ~(REG_CTRL_MANUAL);       // Disable manual mode
+    interface->ctl = interface->ctl & ~(REG_CTRL_ACK_IGNORE);   // Disable ACK IGNORE
+    interface->ctl = interface->ctl | (REG_CTRL_CNTL_JIC);      // Bypass dynamic clock gating
+
+    // Clocking is set per bus by i2cSetSpeed once the driver state is up
+
+    // Disable SCL and SDA filtering
+    interface->addr &= ~(REG_ADDR_SCLFILTER);
+    interface->addr &= ~(REG_ADDR_SDAFILTER);
 }
 
 /**
  * Given a bus number, retrieve the error code stored in the control register
  * associated.
  * @param bus i2c EE-domain master interface to check
- * @return int error number - non-negative numbers are a success with n. bytes read / 0 if writing,
- *         while a negative value corresponds to a bus NACK at a token of value -(ret).
- *         e.g. if NACK on a ADDRW (0x3) the return value will be -3.
+ * @return int error number - non-negative numbers are a success with n. bytes read by the
+ *         last run of the list processor / 0 if writing, while a negative value corresponds
+ *         to a bus NACK at token index -(ret) - 1 of the token list.
  */
 static inline int i2cGetError(int bus) {
-    // Index into ctl register - i2c base + address of appropriate register
-    volatile uint32_t ctl = (bus == 2) ? if_m2->ctl : if_m3->ctl;
-    uint8_t err = ctl & (1 << 3);   // bit 3 -> set if error
-    uint8_t rd = ctl & 0xF00; // bits 8-11 -> number of bytes read
-    uint8_t tok = ctl & 0xF0; // bits 4-7 -> curr token
-
-    if (err) {
-        return -tok;
+    uint32_t ctl = i2cRegs(bus)->ctl;
+    int rd = (ctl & REG_CTRL_RD_CNT) >> 8;
+    int tok = (ctl & REG_CTRL_CURR_TK) >> 4;
+
+    if (ctl & REG_CTRL_ERROR) {
+        return -tok - 1;
     } else {
         return rd;
     }
 }
 
-static inline int i2cStart(i2c_if_t *interface) {
-    printf("i2c: LIST PROCESSOR START\n");
-    interface->ctl &= ~0x1;
-    interface->ctl |= 0x1;
-    if (!(interface->ctl & 0x1)) {
-        sel4cp_dbg_puts("i2c: failed to set start bit!\n");
-        return -1;
+/**
+ * Look up which kind of token sits at an index of the loaded token list.
+ * @return OC4_I2C_TK_* value
+ */
+static inline uint32_t i2cTokenAt(i2c_if_t *interface, int idx) {
+    if (idx < 8) {
+        return (interface->tk_list0 >> (idx * 4)) & 0xF;
+    }
+    return (interface->tk_list1 >> ((idx - 8) * 4)) & 0xF;
+}
+
+/**
+ * Copy the bytes read by the last run of the list processor into the return
+ * buffer, after whatever earlier runs of this request read.
+ */
+static inline void i2cReadData(int bus, i2c_if_t *interface, ret_buf_ptr_t ret, int n) {
+    if (n > 8) {
+        n = 8;
+    }
+    size_t room = i2c_ifState[bus].ret_cap - i2c_ifState[bus].ret_len;
+    if ((size_t) n > room) {
+        sel4cp_dbg_puts("i2c: read overflows return buffer!\n");
+        n = room;
     }
+
+    // rdata0 holds the first four bytes, least significant first, then rdata1
+    uint32_t rdata[2];
+    rdata[0] = interface->rdata0;
+    if (n > 4) {
+        rdata[1] = interface->rdata1;
+    }
+    volatile uint8_t *dst = ret + RET_BUF_HDR_SZ + i2c_ifState[bus].ret_len;
+    for (int i = 0; i < n; i++) {
+        dst[i] = rdata[i / 4] >> ((i % 4) * 8);
+    }
+    i2c_ifState[bus].ret_len += n;
+}
+
+static inline int i2cStart(i2c_if_t *interface) {
+    // The list processor starts on a rising edge of the start bit
+    uint32_t ctl = interface->ctl & ~REG_CTRL_START;
+    interface->ctl = ctl;
+    interface->ctl = ctl | REG_CTRL_START;
     return 0;
 }
 
 static inline int i2cHalt(i2c_if_t *interface) {
-    printf("i2c: LIST PROCESSOR HALT\n");
+    i2cDebug("i2c: LIST PROCESSOR HALT\n");
     interface->ctl &= ~0x1;
     if ((interface->ctl & 0x1)) {
         sel4cp_dbg_puts("i2c: failed to halt!\n");
@@ -315,143 +464,56 @@ static inline int i2cHalt(i2c_if_t *interface) {
     return 0;
 }
 
-static inline int i2cFlush(i2c_if_t *interface) {
-    printf("i2c: LIST PROCESSOR FLUSH\n");
-    // Clear token list
-    interface->tk_list0 = 0x0;
-    interface->tk_list1 = 0x0;
-
-    // // Clear wdata
-    // interface->wdata0 = 0x0;
-    // interface->wdata1 = 0x0;
-
-    // // Clear rdata
-    // interface->rdata0 = 0x0;
-    // interface->rdata1 = 0x0;
-
-    // // Clear address
-    // interface->addr = 0x0;
-    return 0;
+/**
+ * Load one chunk into the list processor and start it. Each register is written
+ * exactly once, with no reads of device memory beyond the control register.
+ */
+static inline void i2cLoadChunk(int bus, i2c_if_t *interface, uint8_t addr,
+                                const volatile i2c_chunk_t *chunk) {
+    // i2c hardware expects that the 7-bit address is shifted left by 1
+    interface->addr = i2c_ifState[bus].addr_base | ((uint32_t) addr << 1);
+    interface->tk_list0 = chunk->tk_list0;
+    interface->tk_list1 = chunk->tk_list1;
+    interface->wdata0 = chunk->wdata0;
+    interface->wdata1 = chunk->wdata1;
+    i2cStart(interface);
 }
 
 static inline int i2cLoadTokens(int bus) {
-    sel4cp_dbg_puts("driver: starting token load\n");
-    i2c_token_t * tokens = (i2c_token_t *)i2c_ifState[bus].current_req;
-    printf("Tokens remaining in this req: %zu\n", i2c_ifState[bus].remaining);
-    
-    // Extract second byte: address
-    uint8_t addr = tokens[1];
-    if (addr > 0x7F) {
-        sel4cp_dbg_puts("i2c: attempted to write to address > 7-bit range!\n");
-        return -1;
-    }
+    uint64_t t0 = i2cProfileStart();
+    i2cDebug("driver: starting token load, %zu runs remaining in this req\n", i2c_ifState[bus].remaining);
+
+    // First two bytes are the client ID and address, then the tokens
+    const i2c_token_t *req = (const i2c_token_t *) i2c_ifState[bus].current_req;
+    uint8_t addr = req[1];      // Checked to be 7-bit in startRequest
     COMPILER_MEMORY_FENCE();
-    volatile i2c_if_t *interface = (bus == 2) ? if_m2 : if_m3;
-    // i2cHalt(interface);
-    i2cFlush(interface);
-    // Load address into address register
-    // Address goes into low 7 bits of address register
-    interface->addr = interface->addr & ~(0x7F);
-    interface->addr = interface->addr | ((addr& 0x7f) << 1);  // i2c hardware expects that the 7-bit address is shifted left by 1
-
-    // Clear token buffer registers
-    interface->tk_list0 = 0x0;
-    interface->tk_list1 = 0x0;
-    interface->wdata0 = 0x0;
-    interface->wdata1 = 0x0;
-    
-    // Offset into token registers
-    uint32_t tk_offset = 0;
-
-    // Offset into wdata registers
-    uint32_t wdat_offset = 0;
-
-    // Offset into supplied buffer
-    int i = i2c_ifState[bus].current_req_len - i2c_ifState[bus].remaining;
-    printf("Current offset into request: %d\n", i);
-    while (tk_offset < 16 && wdat_offset < 8) {
-        // Explicitly pad END tokens for empty space
-        if (i >= i2c_ifState[bus].current_req_len) {
-            if (tk_offset < 8) {
-                interface->tk_list0 |= (OC4_I2C_TK_END << (tk_offset * 4));
-                tk_offset++;
-            } else {
-                interface->tk_list1 = interface->tk_list1 | (OC4_I2C_TK_END << ((tk_offset -8) * 4));
-                tk_offset++;
-            }
-            i++;
-            continue;
-        }
-        
-        // Skip first two: client id and addr
-        i2c_token_t tok = tokens[2 + i];
-        uint32_t odroid_tok = 0x0;
-        // Translate token to ODROID token
-        switch (tok) {
-            case I2C_TK_END:
-                odroid_tok = OC4_I2C_TK_END;
-                break;
-            case I2C_TK_START:
-                odroid_tok = OC4_I2C_TK_START;
-                break;
-            case I2C_TK_ADDRW:
-                odroid_tok = OC4_I2C_TK_ADDRW;
-                i2c_ifState[bus].ddr = 0;
-                break;
-            case I2C_TK_ADDRR:
-                odroid_tok = OC4_I2C_TK_ADDRR;
-                i2c_ifState[bus].ddr = 1;
-                break;
-            case I2C_TK_DAT:
-                odroid_tok = OC4_I2C_TK_DATA;
-                break;
-            case I2C_TK_DATA_END:
-                odroid_tok = OC4_I2C_TK_DATA_END;
-                break;
-            case I2C_TK_STOP:
-                odroid_tok = OC4_I2C_TK_STOP;
-                break;
-            default:
-                printf("i2c: invalid data token in request! \"%x\"\n", tok);
-                return -1;
-        }
-        // printf("Loading token %d: %d\n", i, odroid_tok);
-
-        if (tk_offset < 8) {
-            interface->tk_list0 |= ((odroid_tok & 0xF) << (tk_offset * 4));
-            // printf("(odroid_tok << (tk_offset * 4)) == 0x%x\n", (odroid_tok << (tk_offset * 4)));
-            // printf("Token %d: %x\n", i, (interface->tk_list0 >> (tk_offset * 4)) & 0xF);
-            // printf("Raw: 0x%x\n", interface->tk_list0);
-            tk_offset++;
-        } else {
-            interface->tk_list1 = interface->tk_list1 | (odroid_tok << ((tk_offset -8) * 4));
-            // printf("Token %d: %x\n", i, (interface->tk_list1 >> ((tk_offset - 8) * 4)) & 0xF);
-            // printf("Raw: 0x%x\n", interface->tk_list1);
-            tk_offset++;
-        }
-        // If data token and we are writing, load data into wbuf registers
-        if (odroid_tok == OC4_I2C_TK_DATA && !i2c_ifState[bus].ddr) {
-            if (wdat_offset < 4) {
-                interface->wdata0 = interface->wdata0 | (tokens[2 + i + 1] << (wdat_offset * 8));
-                wdat_offset++;
-            } else {
-                interface->wdata1 = interface->wdata1 | (tokens[2 + i + 1] << ((wdat_offset - 4) * 8));
-                wdat_offset++;
-            }
-            // Since we grabbed the next token in the chain, increment offset
-            i++;
-        }
-        i++;
+    volatile i2c_if_t *interface = i2cRegs(bus);
+
+    // Compiled programs are already in register form
+    if (i2c_ifState[bus].prog) {
+        const volatile i2c_prog_t *prog = i2c_ifState[bus].prog;
+        i2cLoadChunk(bus, interface, addr, &prog->chunks[i2c_ifState[bus].prog_chunk++]);
+        i2cProfileEnd(bus, t0);
+        i2c_ifState[bus].remaining--;
+        COMPILER_MEMORY_FENCE();
+        return 0;
     }
 
-    // Data loaded. Update remaining tokens indicator and start list processor
-    i2c_ifState[bus].remaining = (i2c_ifState[bus].current_req_len - i > 0) 
-                                 ? i2c_ifState[bus].current_req_len - i : 0;
-
-    printf("driver: Tokens loaded. %zu remain for this request\n", i2c_ifState[bus].remaining);
-    i2cDump(interface);
-    // Start list processor
-    i2cStart(interface);
+    // Build the register values for the next chunk locally, then load them.
+    // The request was planned in startRequest, so this cannot fail part way.
+    i2c_enc_t enc = i2c_ifState[bus].enc;
+    i2c_chunk_t chunk;
+    if (i2cEncodeChunk(req + 2, i2c_ifState[bus].current_req_len, &enc, &chunk)) {
+        return -1;
+    }
+    i2c_ifState[bus].enc = enc;
+    i2cLoadChunk(bus, interface, addr, &chunk);
+    i2cProfileEnd(bus, t0);
+
+    // Update remaining runs indicator
+    i2c_ifState[bus].remaining--;
+    i2cDebug("driver: Tokens loaded. %zu runs remain for this request\n", i2c_ifState[bus].remaining);
+    i2cDebugDump(interface);
     COMPILER_MEMORY_FENCE();
 
     return 0;
@@ -459,80 +521,344 @@ static inline int i2cLoadTokens(int bus) {
 
 
 
+/**
+ * Program the clock divider and SCL low time of a bus for one of the I2C_SPEED_*
+ * modes, computed from the clk81 rate. Every mode uses the 40% high / 60% low
+ * duty cycle the i2c spec needs at fast mode and above, which also meets the
+ * standard mode minimums. Only call while the bus is idle.
+ * @return 0 on success, -1 if mode is not a known speed.
+*/
+static inline int i2cSetSpeed(int bus, uint8_t mode) {
+    uint32_t freq;
+    switch (mode) {
+        case I2C_SPEED_STD:
+            freq = 100000;
+            break;
+        case I2C_SPEED_FAST:
+            freq = 400000;
+            break;
+        case I2C_SPEED_FASTPLUS:
+            freq = 1000000;
+            break;
+        default:
+            return -1;
+    }
+    if (i2c_bus[bus].speed == freq) {
+        return 0;
+    }
+
+    // As in the Linux meson driver: the divider gives the high period in clk81
+    // cycles, less the delay of the input filter, while the low period is set
+    // separately in half-cycle units through the SCL delay field.
+    // Duty  = H/(H + L) = 2/5
+    uint32_t div_h = (I2C_CLK81_RATE * 2ULL + freq * 5 - 1) / (freq * 5) - I2C_FILTER_DELAY;
+    uint32_t div_l = (I2C_CLK81_RATE * 3ULL + freq * 10 - 1) / (freq * 10);
+
+    volatile i2c_if_t *interface = i2cRegs(bus);
+    uint32_t ctl = interface->ctl & ~(REG_CTRL_CLKDIV_MASK | REG_CTRL_CLKDIVEXT_MASK);
+    ctl |= ((div_h & 0x3FF) << REG_CTRL_CLKDIV_SHIFT) | ((div_h >> 10) << REG_CTRL_CLKDIVEXT_SHIFT);
+    interface->ctl = ctl;
+
+    // The low period lives in the address register, so keep the shadow in step
+    uint32_t addr = i2c_ifState[bus].addr_base & ~REG_ADDR_SCLDELAY_MASK;
+    addr |= (div_l << REG_ADDR_SCLDELAY_SHFT) | REG_ADDR_SCLDELAY_ENABLE;
+    i2c_ifState[bus].addr_base = addr;
+    interface->addr = addr;
+
+    i2c_bus[bus].speed = freq;
+    i2cDebug("driver: bus %d running at %u Hz (div_h %u, div_l %u)\n", bus, freq, div_h, div_l);
+    return 0;
+}
+
+/**
+ * Bring up a bus this driver runs: its master's registers and driver state.
+*/
+static inline void busInit(int i) {
+    setupMaster(i);
+    volatile i2c_if_t *interface = i2cRegs(i);
+    i2c_ifState[i].addr_base = interface->addr & ~0xFF;
+    i2c_bus[i].speed = 0;
+    i2cSetSpeed(i, I2C_SPEED_FAST);
+    i2c_ifState[i].current_req = NULL;
+    i2c_ifState[i].current_ret = NULL;
+    i2c_ifState[i].current_req_len = 0;
+    i2c_ifState[i].remaining = 0;
+    i2c_ifState[i].prog = NULL;
+    i2c_ifState[i].prog_chunk = 0;
+    i2c_ifState[i].ret_len = 0;
+    i2c_ifState[i].ret_cap = 0;
+    i2c_ifState[i].backlog_head = 0;
+    i2c_ifState[i].backlog_count = 0;
+}
+
+#ifdef I2C_DRIVER_PADS
 void init(void) {
-    setupi2c();
+    setupPads();
+    // Each per-bus driver waits for this before touching its master
+    for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        if (i2cBusConfigured(bus)) {
+            sel4cp_notify(PADS_DRIVER_NOTIFY_ID(bus));
+        }
+    }
+    sel4cp_dbg_puts("Pads initialised.\n");
+}
+#else
+void init(void) {
+    // The transport decides which buses are in use, so it comes up first
     i2cTransportInit(0);
-    // Set up driver state
-    for (int i = 2; i < 4; i++) {
-        i2c_ifState[i].current_req = NULL;
-        i2c_ifState[i].current_ret = NULL;
-        i2c_ifState[i].current_req_len = 0;
-        i2c_ifState[i].remaining = 0;
-        i2c_ifState[i].notified = 0;
+#ifdef I2C_DRIVER_BUS
+    // The bus comes up once i2c_pads has set up the pads and clock (padsReady)
+#else
+    setupPads();
+    for (int i = 0; i < I2C_NUM_BUSES; i++) {
+        if (busActive(i)) {
+            busInit(i);
+        }
     }
     sel4cp_dbg_puts("Driver initialised.\n");
+#endif
 }
+#endif
 
 /**
- * Check if there is work to do for a given bus and dispatch it if so.
+ * Answer a request straight away with just a return header, without running it
+ * on the bus.
 */
-static inline void checkBuf(int bus) {
-    sel4cp_dbg_puts("driver: checking bus ");
-    sel4cp_dbg_putc((char)bus + '0');
-    sel4cp_dbg_puts("\n");
-
-    if (!reqBufEmpty(bus)) {
-        // If this interface is busy, skip notification and
-        // set notified flag for later processing
-        if (i2c_ifState[bus].current_req) {
-            sel4cp_dbg_puts("driver: request in progress, deferring notification\n");
-            i2c_ifState[bus].notified = 1;
-            return;
+static inline void i2cReply(int bus, req_buf_ptr_t req, uint8_t err, uint8_t tk) {
+    ret_buf_ptr_t ret = getRetBuf(bus, RET_BUF_HDR_SZ);
+    if (ret) {
+        ret[RET_BUF_ERR] = err;
+        ret[RET_BUF_ERR_TK] = tk;
+        ret[RET_BUF_CLIENT] = req[0];
+        ret[RET_BUF_ADDR] = req[1];
+        pushRetBuf(bus, ret, RET_BUF_HDR_SZ);
+        if (retBufNeedsNotify(bus)) {
+            sel4cp_notify(SERVER_NOTIFY_ID);
         }
-        sel4cp_dbg_puts("driver: starting work for bus\n");
-        // Otherwise, begin work. Start by extracting the request
-
-        size_t sz = 0;
-        req_buf_ptr_t req = popReqBuf(bus, &sz);
-        printf("SZ: %zu\n", sz);
+    }
+    releaseReqBuf(bus, req);
+}
 
-        if (!req) {
-            return;   // If request was invalid, run away.
+/**
+ * Set a request running on an idle bus.
+ * @return 0 if the request is now in flight, 1 if it was answered straight away
+ *         with an error, or -1 if there is no return buffer for it yet. In that
+ *         case the server notifies once it releases one.
+*/
+static inline int startRequest(int bus, req_buf_ptr_t req, size_t sz) {
+    // Requests to run a compiled program carry only its ID. Anything else is
+    // planned up front, which sizes the return buffer and catches malformed
+    // requests before they get anywhere near the bus.
+    const volatile i2c_prog_t *prog = NULL;
+    i2c_plan_t plan;
+    if (sz <= 2 || req[1] > 0x7F) {
+        printf("driver: malformed request from client %u\n", req[0]);
+        i2cReply(bus, req, I2C_ERR_MALFORMED, 0);
+        return 1;
+    } else if (sz > 3 && req[2] == I2C_TK_PROG) {
+        prog = i2cProgGet(req[3]);
+        if (!prog) {
+            printf("driver: request for unknown program %u\n", req[3]);
+            i2cReply(bus, req, I2C_ERR_BADPROG, I2C_TK_PROG);
+            return 1;
         }
-        ret_buf_ptr_t ret = getRetBuf(bus);
-
-        // Load bookkeeping data into return buffer
-        // Set client PD
+        plan.runs = prog->nchunks;
+        plan.rd_cnt = prog->rd_cnt;
+    } else if (sz > 3 && req[2] == I2C_TK_SPEED) {
+        // The bus is idle here, so everything queued before this has finished.
+        // Only failures are worth a trip back to the server.
+        if (i2cSetSpeed(bus, req[3])) {
+            i2cReply(bus, req, I2C_ERR_MALFORMED, 0);
+        } else {
+            releaseReqBuf(bus, req);
+        }
+        return 1;
+    } else if (i2cPlan((const i2c_token_t *) req + 2, sz - 2, &plan)) {
+        printf("driver: malformed request from client %u\n", req[0]);
+        i2cReply(bus, req, I2C_ERR_MALFORMED, 0);
+        return 1;
+    }
+    // A request that reads more than the largest return buffer holds could
+    // never start, and would hold up everything queued behind it
+    size_t ret_sz = RET_BUF_HDR_SZ + plan.rd_cnt;
+    if (ret_sz > I2C_BUF_SZ) {
+        printf("driver: request from client %u reads too much\n", req[0]);
+        i2cReply(bus, req, I2C_ERR_MALFORMED, 0);
+        return 1;
+    }
+    ret_buf_ptr_t ret;
+    while (!(ret = getRetBuf(bus, ret_sz))) {
+        // The server has every return buffer. Ask to be told when it frees
+        // one, unless one came back while asking.
+        if (retBufRequestFree(bus, ret_sz)) {
+            sel4cp_dbg_puts("i2c: no ret buf!\n");
+            return -1;
+        }
+    }
 
-        printf("driver: Loading request from client %u on bus %u to address %x of sz %zu\n", req[0], bus, req[1], sz);
-        // printf("ret_data: %p\n", ret);
-        // printf("ret %p\n", ret);
+    // Load bookkeeping data into return buffer
+    i2cDebug("driver: Loading request from client %u on bus %u to address %x of sz %zu\n", req[0], bus, req[1], sz);
+    ret[RET_BUF_CLIENT] = req[0];      // Client PD
+    ret[RET_BUF_ADDR] = req[1];        // Address
+    // Bytes 0 and 1 are for error code / location respectively and are set later
+
+    i2c_ifState[bus].current_req = req;
+    i2c_ifState[bus].current_req_len = sz - 2;  // Ignore client PD and address
+    i2c_ifState[bus].remaining = plan.runs;
+    i2c_ifState[bus].enc = (i2c_enc_t) {0};
+    i2c_ifState[bus].prog = prog;
+    i2c_ifState[bus].prog_chunk = 0;
+    i2c_ifState[bus].ret_len = 0;
+    i2c_ifState[bus].ret_cap = ret_sz - RET_BUF_HDR_SZ;
+    i2c_ifState[bus].current_ret = ret;
+
+    // Trigger work start
+    i2cLoadTokens(bus);
+    return 0;
+}
 
-        ret[RET_BUF_CLIENT] = req[0];      // Client PD
-        // Set targeted i2c address
-        ret[RET_BUF_ADDR] = req[1];      // Address
+/**
+ * Per-bus dispatcher. While the bus is idle, take the next queued request and
+ * start it, skipping over any that are answered without touching the bus. Runs
+ * on every server notification and every completed request, so a loaded bus
+ * goes straight from one transaction to the next without a round trip through
+ * the server. Does nothing while a request is in flight: the completion IRQ
+ * will come back here.
+*/
+static inline void dispatch(int bus) {
+    while (!i2c_ifState[bus].current_req) {
+        // Requests are pulled from the server in batches to save on ring updates
+        if (!i2c_ifState[bus].backlog_count) {
+            req_buf_ptr_t bufs[I2C_BATCH_MAX];
+            size_t sizes[I2C_BATCH_MAX];
+            int n = popReqBufs(bus, bufs, sizes, I2C_BATCH_MAX);
+            for (int i = 0; i < n; i++) {
+                i2c_ifState[bus].backlog[i] = bufs[i];
+                i2c_ifState[bus].backlog_sz[i] = sizes[i];
+            }
+            i2c_ifState[bus].backlog_head = 0;
+            i2c_ifState[bus].backlog_count = n;
+        }
 
-        if (sz <=2 || sz > I2C_BUF_SZ) {
-            printf("Invalid request size: %zu!\n", sz);
+        if (!i2c_ifState[bus].backlog_count) {
+            // The bus is going idle, so ask the server to notify us about the
+            // next request. If one slipped in while we were asking, take it now.
+            if (reqBufRequestNotify(bus)) {
+                return;
+            }
+            continue;
         }
-        // printf("ret buf first 4 bytes: %x %x %x %x\n", ret[0], ret[1], ret[2], ret[3]);
-        i2c_ifState[bus].current_req = req;
-        i2c_ifState[bus].current_req_len = sz - 2;
-        i2c_ifState[bus].remaining = sz - 2;    // Ignore client PD and address
-        i2c_ifState[bus].notified = 0;
-        i2c_ifState[bus].current_ret = ret;
-        if (!i2c_ifState[bus].current_ret) {
-            sel4cp_dbg_puts("i2c: no ret buf!\n");
+
+        int head = i2c_ifState[bus].backlog_head;
+        req_buf_ptr_t req = i2c_ifState[bus].backlog[head];
+        if (req && startRequest(bus, req, i2c_ifState[bus].backlog_sz[head]) < 0) {
+            // Out of return buffers: leave the request queued and retry once
+            // the server releases one and notifies us.
+            return;
         }
+        i2c_ifState[bus].backlog_head++;
+        i2c_ifState[bus].backlog_count--;
+    }
+}
+
+/**
+ * Collect the result of a finished run of the list processor, then keep the bus
+ * busy: start the next run of this request, or finish it and start the next one.
+ * @param bus The bus the run finished on
+ * @param timeout Whether the run timed out. 0 if not, 1 if so.
+*/
+static inline void i2cComplete(int bus, int timeout) {
+    volatile i2c_if_t *interface = i2cRegs(bus);
+    i2cDebugDump(interface);
+    i2cHalt(interface);
+
+    // Nothing was in flight, so there is no result to collect
+    if (!i2c_ifState[bus].current_req) {
+        dispatch(bus);
+        return;
+    }
+
+    // Get result
+    int err = i2cGetError(bus);
+    // If error is 0, successful write. If error >0, successful read of err bytes.
+    // Prepare to extract data from the interface.
+    ret_buf_ptr_t ret = i2c_ifState[bus].current_ret;
 
-        // Bytes 0 and 1 are for error code / location respectively and are set later
+    i2cDebug("ret %p\n", ret);
+    // Pull out what this run read before the next one overwrites it
+    if (!timeout && err > 0) {
+        i2cReadData(bus, interface, ret, err);
+    }
 
-        // Trigger work start
+    // If there is still work to do on this request, get the bus going again
+    // straight away. Everything else here can happen while it runs.
+    if (!timeout && err >= 0 && i2c_ifState[bus].remaining) {
+        i2cDebug("driver: still work to do, starting next batch\n");
         i2cLoadTokens(bus);
+        return;
+    }
+
+    // Otherwise the request is finished. If there was an error, the rest of it
+    // is cancelled and the error information goes into the return buffer.
+    if (timeout || err < 0) {
+        i2cDebug("i2c: error!\n");
+        int idx = (err < 0) ? -err - 1 : 0;
+        if (timeout) {
+            ret[RET_BUF_ERR] = I2C_ERR_TIMEOUT;
+        } else if (i2cTokenAt(interface, idx) == OC4_I2C_TK_ADDRR) {
+            ret[RET_BUF_ERR] = I2C_ERR_NOREAD;
+        } else {
+            ret[RET_BUF_ERR] = I2C_ERR_NACK;
+        }
+        ret[RET_BUF_ERR_TK] = idx;   // Token that caused error
     } else {
-        sel4cp_dbg_puts("driver: called but no work available: resetting notified flag\n");
-        // If nothing needs to be done, clear notified flag if it was set.
-        i2c_ifState[bus].notified = 0;
+        ret[RET_BUF_ERR] = I2C_ERR_OK;    // Error code
+        ret[RET_BUF_ERR_TK] = 0x0;           // Token that caused error
+    }
+
+    // Queue the return first so returns stay in request order, then free the
+    // bus and let the dispatcher start the next request before the slower
+    // bookkeeping. The server runs below us, so notifying it first would only
+    // leave the bus idle for longer.
+    i2cDebug("driver: request completed or error, returning to server\n");
+    req_buf_ptr_t req = i2c_ifState[bus].current_req;
+    pushRetBuf(bus, ret, RET_BUF_HDR_SZ + i2c_ifState[bus].ret_len);
+    i2c_ifState[bus].current_ret = NULL;
+    i2c_ifState[bus].current_req = 0x0;
+    i2c_ifState[bus].current_req_len = 0;
+    i2c_ifState[bus].remaining = 0;
+    i2c_ifState[bus].prog = NULL;
+    dispatch(bus);
+
+    releaseReqBuf(bus, req);
+    if (retBufNeedsNotify(bus)) {
+        sel4cp_notify(SERVER_NOTIFY_ID);
+    }
+}
+
+/**
+ * Spin on the status bit while the list processor runs, up to the bus's poll
+ * budget.
+ * @return 1 if the run finished within the budget, 0 if it is left to the IRQ.
+*/
+static inline int i2cPoll(int bus) {
+    volatile i2c_if_t *interface = i2cRegs(bus);
+    for (uint32_t i = 0; i < i2c_pollBudget[bus]; i++) {
+        if (!(interface->ctl & REG_CTRL_STATUS)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Hybrid polling: complete runs on a bus by spinning for as long as each one
+ * finishes inside the poll budget. Falls back to the IRQ for the first run that
+ * does not.
+*/
+static inline void pollBus(int bus) {
+    while (i2c_ifState[bus].current_req && i2cPoll(bus)) {
+        i2cComplete(bus, 0);
     }
 }
 
@@ -548,9 +874,12 @@ static inline void serverNotify(void) {
     // they operate in parallel and notifications carry no other info.
     
     // If there is work to do, attempt to do it
-    sel4cp_dbg_puts("i2c: driver notified!\n");
-    for (int i = 2; i < 4; i++) {
-        checkBuf(i);
+    i2cDebug("i2c: driver notified!\n");
+    for (int i = 0; i < I2C_NUM_BUSES; i++) {
+        if (busActive(i)) {
+            dispatch(i);
+            pollBus(i);
+        }
     }
 }
 
@@ -560,103 +889,71 @@ static inline void serverNotify(void) {
  * @param timeout Whether the IRQ was triggered by a timeout. 0 if not, 1 if so.
 */
 static inline void i2cirq(int bus, int timeout) {
-    printf("i2c: driver irq for bus %d\n", bus);
-    // printf("notified = %d\n", i2c_ifState[bus].notified);
-    
+    i2cDebug("i2c: driver irq for bus %d\n", bus);
+
     // IRQ landed: i2c transaction has either completed or timed out.
     if (timeout) {
         sel4cp_dbg_puts("i2c: timeout!\n");
     }
 
-    volatile i2c_if_t *interface = (bus == 2) ? if_m2 : if_m3;
-    i2cDump(interface);
-    i2cHalt(interface);
-
-    // Get result
-    int err = i2cGetError(bus);
-    // If error is 0, successful write. If error >0, successful read of err bytes.
-    // Prepare to extract data from the interface.
-    ret_buf_ptr_t ret = i2c_ifState[bus].current_ret;
-
-    printf("ret %p\n", ret);
-    // If there was an error, cancel the rest of this transaction and load the
-    // error information into the return buffer.
-    if (err < 0) {
-        sel4cp_dbg_puts("i2c: error!\n");
-        if (timeout) {
-            ret[RET_BUF_ERR] = I2C_ERR_TIMEOUT;
-        } else if (err == -I2C_TK_ADDRR) {
-            ret[RET_BUF_ERR] = I2C_ERR_NOREAD;
-        } else {
-            ret[RET_BUF_ERR] = I2C_ERR_NACK;
-        }
-        ret[RET_BUF_ERR_TK] = -err;   // Token that caused error
-    } else {
-        // If there was a read, extract the data from the interface
-        // FIXME: this is obviously sus
-        if (err > 0) {
-            // Get read data
-
-            // Copy data into return buffer
-            for (int i = 0; i < err; i++) {
-                ret[4+i] = (uint8_t)((interface->rdata0 & 0xFF000000) >> 24);
-            }
-        }
-
-        ret[RET_BUF_ERR] = I2C_ERR_OK;    // Error code
-        ret[RET_BUF_ERR_TK] = 0x0;           // Token that caused error
-    }
-    // printf("IRQ2: ret buf first 4 bytes: %x %x %x %x\n", ret[0], ret[1], ret[2], ret[3]);
-
-    // If request is completed or there was an error, return data to server and notify.
-    if (err < 0 || !i2c_ifState[bus].remaining) {
-        printf("driver: request completed or error, returning to server\n");
-        pushRetBuf(bus, i2c_ifState[bus].current_ret, i2c_ifState[bus].current_req_len);
-        releaseReqBuf(bus, i2c_ifState[bus].current_req);
-        i2c_ifState[bus].current_ret = NULL;
-        i2c_ifState[bus].current_req = 0x0;
-        i2c_ifState[bus].current_req_len = 0;
-        i2c_ifState[bus].remaining = 0;
-        sel4cp_notify(SERVER_NOTIFY_ID);
-        // Reset hardware
-        i2cHalt(interface);
+    // Runs completed by polling still raise their IRQ. If the list processor is
+    // busy, this is one of those landing during a later run, so leave it be.
+    volatile i2c_if_t *interface = i2cRegs(bus);
+    if (!timeout && (interface->ctl & REG_CTRL_STATUS)) {
+        return;
     }
 
-    // If the driver was notified while this transaction was in progress, immediately start working on the next one.
-    // OR if there is still work to do, crack on with it.
-    // NOTE: this incurs more stack depth than needed; could use flag instead?
-    if (i2c_ifState[bus].notified || i2c_ifState[bus].remaining) {
-        if (i2c_ifState[bus].notified) printf("driver: notified while processing IRQ, starting next request\n");
-        else { printf("driver: still work to do, starting next batch\n");}
-        i2cLoadTokens(bus);
-    }
-    printf("driver: END OF IRQ HANDLER - notified=%d\n", i2c_ifState[bus].notified);
+    i2cComplete(bus, timeout);
+    pollBus(bus);
+    i2cDebug("driver: END OF IRQ HANDLER\n");
 }
 
 
 
+#ifdef I2C_DRIVER_PADS
 void notified(sel4cp_channel c) {
-    switch (c) {
-        case SERVER_NOTIFY_ID:
-            serverNotify();
-            break;
-        case IRQ_I2C_M2:
-            i2cirq(2,0);
-            sel4cp_irq_ack(IRQ_I2C_M2);
-            break;
-        case IRQ_I2C_M2_TO:
-            i2cirq(2,1);
-            sel4cp_irq_ack(IRQ_I2C_M2_TO);
-            break;
-        case IRQ_I2C_M3:
-            i2cirq(3,0);
-            sel4cp_irq_ack(IRQ_I2C_M3);
-            break;
-        case IRQ_I2C_M3_TO:
-            i2cirq(3,1);
-            sel4cp_irq_ack(IRQ_I2C_M3_TO);
-            break;
-        default:
-            sel4cp_dbg_puts("DRIVER|ERROR: unexpected notification!\n");
+    sel4cp_dbg_puts("PADS|ERROR: unexpected notification!\n");
+}
+#else
+#ifdef I2C_DRIVER_BUS
+// Set once i2c_pads has set up the pads and clock and the bus is up. Until then
+// requests stay queued in the rings.
+static int padsReady = 0;
+#endif
+
+void notified(sel4cp_channel c) {
+#ifdef I2C_DRIVER_BUS
+    if (c == PADS_READY_ID) {
+        if (!padsReady && busActive(I2C_DRIVER_BUS)) {
+            busInit(I2C_DRIVER_BUS);
+        }
+        padsReady = 1;
+        sel4cp_dbg_puts("Driver initialised.\n");
+        // Pick up anything the server queued in the meantime
+        serverNotify();
+        return;
+    }
+#endif
+    if (c == SERVER_NOTIFY_ID) {
+#ifdef I2C_DRIVER_BUS
+        if (!padsReady) {
+            return;
+        }
+#endif
+        serverNotify();
+        return;
     }
-}
\ No newline at end of file
+
+    // Otherwise it is one of the interfaces' IRQs
+    for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        if (c == i2c_ifDesc[bus].irq || c == i2c_ifDesc[bus].irq_to) {
+            if (busActive(bus)) {
+                i2cirq(bus, c == i2c_ifDesc[bus].irq_to);
+            }
+            sel4cp_irq_ack(c);
+            return;
+        }
+    }
+    sel4cp_dbg_puts("DRIVER|ERROR: unexpected notification!\n");
+}
+#endif
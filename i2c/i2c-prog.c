@@ -0,0 +1,241 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// i2c-prog.c
+// Chunk encoder and program cache for pre-compiled i2c transactions. Imported
+// by both the driver and server: the server compiles programs into the cache
+// and the driver runs them.
+
+#include <sel4cp.h>
+#include "i2c-driver.h"
+#include "i2c-prog.h"
+#include "odroidc4-i2c-mem.h"
+#include "fence.h"
+#include "printf.h"
+
+_Static_assert(sizeof(i2c_prog_t) * I2C_PROG_MAX <= I2C_PROG_REGION_SZ,
+               "program cache does not fit its region");
+
+uintptr_t i2c_progs;
+
+#define PROGS ((volatile i2c_prog_t *) i2c_progs)
+
+// Hardware limits of one load of the list processor
+#define CHUNK_TOKENS 16
+#define CHUNK_WDATA 8
+#define CHUNK_RDATA 8
+
+static inline void putToken(i2c_chunk_t *chunk, uint32_t tok) {
+    if (chunk->tk_cnt < 8) {
+        chunk->tk_list0 |= tok << (chunk->tk_cnt * 4);
+    } else {
+        chunk->tk_list1 |= tok << ((chunk->tk_cnt - 8) * 4);
+    }
+    chunk->tk_cnt++;
+}
+
+static inline void putData(i2c_chunk_t *chunk, uint8_t data) {
+    if (chunk->wr_cnt < 4) {
+        chunk->wdata0 |= (uint32_t) data << (chunk->wr_cnt * 8);
+    } else {
+        chunk->wdata1 |= (uint32_t) data << ((chunk->wr_cnt - 4) * 8);
+    }
+    chunk->wr_cnt++;
+}
+
+int i2cEncodeChunk(const i2c_token_t *tokens, size_t len, i2c_enc_t *enc,
+                   i2c_chunk_t *chunk) {
+    *chunk = (i2c_chunk_t) {0};
+    size_t i = enc->pos;
+
+    // Take tokens until one of the chunk's limits is reached. Since every token
+    // only ever uses up space, packing each chunk as full as possible gives the
+    // fewest loads of the list processor. The one exception is START, which is
+    // kept in the same load as the address token after it.
+    while (i < len && chunk->tk_cnt < CHUNK_TOKENS) {
+        i2c_token_t tok = tokens[i];
+
+        // Runs of data expand to one DATA token per byte. Whatever part of the
+        // run does not fit in this chunk starts the next one.
+        if (I2C_TK_IS_DATN(tok)) {
+            int n = I2C_TK_DATN_LEN(tok);
+            int write = !enc->ddr;
+            if (write && i + n >= len) {
+                sel4cp_dbg_puts("i2c: data run overflows request!\n");
+                return -1;
+            }
+            while (enc->run < n && chunk->tk_cnt < CHUNK_TOKENS) {
+                if (write) {
+                    if (chunk->wr_cnt == CHUNK_WDATA) {
+                        break;
+                    }
+                    putData(chunk, tokens[i + 1 + enc->run]);
+                } else {
+                    if (chunk->rd_cnt == CHUNK_RDATA) {
+                        break;
+                    }
+                    chunk->rd_cnt++;
+                }
+                putToken(chunk, OC4_I2C_TK_DATA);
+                enc->run++;
+            }
+            if (enc->run < n) {
+                break;
+            }
+            enc->run = 0;
+            i += 1 + (write ? n : 0);
+            continue;
+        }
+
+        // Data bytes land in wdata0/1 or rdata0/1, which hold 8 bytes each
+        if (tok == I2C_TK_DAT && (enc->ddr ? chunk->rd_cnt == CHUNK_RDATA
+                                           : chunk->wr_cnt == CHUNK_WDATA)) {
+            break;
+        }
+        if (tok == I2C_TK_DATA_END && chunk->rd_cnt == CHUNK_RDATA) {
+            break;
+        }
+        // The list processor runs a START and its address as one sequence, as
+        // the Linux meson driver builds its lists, so never end a load between
+        // them. If the address will not fit, START opens the next load instead.
+        if (tok == I2C_TK_START && chunk->tk_cnt == CHUNK_TOKENS - 1 && i + 1 < len &&
+            (tokens[i + 1] == I2C_TK_ADDRW || tokens[i + 1] == I2C_TK_ADDRR)) {
+            break;
+        }
+
+        switch (tok) {
+            case I2C_TK_END:
+                // Unused slots are already OC4_I2C_TK_END, so END takes none.
+                // Nothing after END is part of the transaction.
+                i = len;
+                continue;
+            case I2C_TK_START:
+                putToken(chunk, OC4_I2C_TK_START);
+                break;
+            case I2C_TK_ADDRW:
+                putToken(chunk, OC4_I2C_TK_ADDRW);
+                enc->ddr = 0;
+                break;
+            case I2C_TK_ADDRR:
+                putToken(chunk, OC4_I2C_TK_ADDRR);
+                enc->ddr = 1;
+                break;
+            case I2C_TK_DAT:
+                putToken(chunk, OC4_I2C_TK_DATA);
+                if (enc->ddr) {
+                    chunk->rd_cnt++;
+                    break;
+                }
+                // Payload follows a write
+                if (++i >= len) {
+                    sel4cp_dbg_puts("i2c: data token missing payload!\n");
+                    return -1;
+                }
+                putData(chunk, tokens[i]);
+                break;
+            case I2C_TK_DATA_END:
+                putToken(chunk, OC4_I2C_TK_DATA_END);
+                chunk->rd_cnt++;
+                break;
+            case I2C_TK_STOP:
+                putToken(chunk, OC4_I2C_TK_STOP);
+                break;
+            default:
+                printf("i2c: invalid data token in request! \"%x\"\n", tok);
+                return -1;
+        }
+        i++;
+    }
+
+    // Don't leave a bare END behind to cost a load of its own
+    if (!enc->run && i < len && tokens[i] == I2C_TK_END) {
+        i = len;
+    }
+    enc->pos = i;
+    return 0;
+}
+
+int i2cPlan(const i2c_token_t *tokens, size_t len, i2c_plan_t *plan) {
+    i2c_enc_t enc = {0};
+    i2c_chunk_t chunk;
+    plan->runs = 0;
+    plan->rd_cnt = 0;
+    while (enc.pos < len) {
+        if (i2cEncodeChunk(tokens, len, &enc, &chunk)) {
+            return -1;
+        }
+        if (chunk.tk_cnt) {
+            plan->runs++;
+            plan->rd_cnt += chunk.rd_cnt;
+        }
+    }
+    return plan->runs ? 0 : -1;
+}
+
+int i2cProgCompile(const i2c_token_t *tokens, size_t len, uint8_t addr) {
+    if (addr > 0x7F) {
+        return -1;
+    }
+    int id;
+    for (id = 0; id < I2C_PROG_MAX; id++) {
+        if (!PROGS[id].valid) {
+            break;
+        }
+    }
+    if (id == I2C_PROG_MAX) {
+        sel4cp_dbg_puts("i2c: program cache full!\n");
+        return -1;
+    }
+
+    // Build the program locally so the driver never sees a half written one
+    i2c_prog_t prog = {0};
+    prog.addr = addr;
+    i2c_plan_t plan;
+    if (i2cPlan(tokens, len, &plan)) {
+        return -1;
+    }
+    if (plan.runs > I2C_PROG_MAX_CHUNKS) {
+        sel4cp_dbg_puts("i2c: program too long to compile!\n");
+        return -1;
+    }
+    i2c_enc_t enc = {0};
+    while (prog.nchunks < plan.runs) {
+        i2c_chunk_t *chunk = &prog.chunks[prog.nchunks];
+        i2cEncodeChunk(tokens, len, &enc, chunk);
+        prog.rd_cnt += chunk->rd_cnt;
+        prog.nchunks++;
+    }
+
+    volatile i2c_prog_t *slot = &PROGS[id];
+    slot->addr = prog.addr;
+    slot->nchunks = prog.nchunks;
+    slot->rd_cnt = prog.rd_cnt;
+    for (int c = 0; c < prog.nchunks; c++) {
+        slot->chunks[c] = prog.chunks[c];
+    }
+    THREAD_MEMORY_RELEASE();
+    slot->valid = 1;
+    return id;
+}
+
+void i2cProgFree(int id) {
+    if (id < 0 || id >= I2C_PROG_MAX) {
+        return;
+    }
+    PROGS[id].valid = 0;
+}
+
+const volatile i2c_prog_t *i2cProgGet(int id) {
+    if (id < 0 || id >= I2C_PROG_MAX || !PROGS[id].valid) {
+        return NULL;
+    }
+    THREAD_MEMORY_ACQUIRE();
+    const volatile i2c_prog_t *prog = &PROGS[id];
+    if (!prog->nchunks || prog->nchunks > I2C_PROG_MAX_CHUNKS) {
+        return NULL;
+    }
+    return prog;
+}
@@ -16,27 +16,270 @@
 #include "printf.h"
 
 // Shared memory regions
-uintptr_t m2_req_free;
-uintptr_t m2_req_used;
-uintptr_t m3_req_free;
-uintptr_t m3_req_used;
-
-uintptr_t m2_ret_free;
-uintptr_t m2_ret_used;
-uintptr_t m3_ret_free;
-uintptr_t m3_ret_used;
+uintptr_t i2c_rings;
 uintptr_t driver_bufs;
 
-ring_handle_t m2ReqRing;
-ring_handle_t m2RetRing;
-ring_handle_t m3ReqRing;
-ring_handle_t m3RetRing;
-
-
 void _putchar(char character) {
     sel4cp_dbg_putc(character);
 }
 
+// Buffer size classes, smallest first. Every free ring of a class is backed by
+// (ring depth >> shift) buffers, so the big buffers that only long transfers
+// need are the scarce ones.
+static const struct {
+    uint32_t sz;
+    uint32_t shift;
+} bufClasses[I2C_NUM_CLASSES] = {
+    { I2C_BUF_SZ_SMALL,  0 },
+    { I2C_BUF_SZ_MEDIUM, 0 },
+    { I2C_BUF_SZ,        2 },
+};
+
+// Each class owns one contiguous section of driver_bufs, laid out smallest first.
+// classBase[I2C_NUM_CLASSES] is the end of the last section. Both sides work this
+// out from the same configuration at init time.
+static uint32_t classBase[I2C_NUM_CLASSES + 1];
+
+// Descriptors carry offsets into driver_bufs rather than addresses, since the
+// server and driver do not necessarily map it at the same address.
+static inline uintptr_t bufAddr(uint32_t offset) {
+    return driver_bufs + offset;
+}
+
+static inline uint32_t bufOffset(volatile uint8_t *buf) {
+    return (uintptr_t) buf - driver_bufs;
+}
+
+/**
+ * Work out which size class a buffer belongs to. Also checks that a descriptor
+ * handed over by the other side really is the start of one of our buffers.
+ * @return the class, or -1 if the offset is not a valid buffer.
+ */
+static inline int bufClass(uint32_t offset) {
+    if (offset >= classBase[I2C_NUM_CLASSES]) {
+        return -1;
+    }
+    int c = 0;
+    while (c < I2C_NUM_CLASSES - 1 && offset >= classBase[c + 1]) {
+        c++;
+    }
+    if ((offset - classBase[c]) & (bufClasses[c].sz - 1)) {
+        return -1;
+    }
+    return c;
+}
+
+/**
+ * Find the smallest class whose buffers hold `size` bytes.
+ * @return the class, or -1 if nothing is big enough.
+ */
+static inline int sizeClass(size_t size) {
+    for (int c = 0; c < I2C_NUM_CLASSES; c++) {
+        if (size <= bufClasses[c].sz) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+// Request buffers start with the client ID and i2c address, followed by tokens
+#define REQ_HDR_SZ (2*sizeof(uint8_t))
+
+// Inline requests carry the client and address in the descriptor tag
+#define INLINE_TAG(client, addr) ((uint32_t)(client) | ((uint32_t)(addr) << 8))
+
+// Requests that arrive inline are copied out of the ring into one of these so
+// the driver can hold on to them like any other request buffer. There is one
+// more than the driver's backlog, to cover the request in flight.
+#define I2C_INLINE_BUFS (I2C_BATCH_MAX + 1)
+#define I2C_INLINE_BUF_SZ (2 + I2C_INLINE_MAX)
+
+typedef struct inline_pool {
+    uint8_t bufs[I2C_INLINE_BUFS][I2C_INLINE_BUF_SZ];
+    uint32_t in_use;    // Bitmap of bufs handed out
+} inline_pool_t;
+
+// Rings for one direction of a bus
+typedef struct i2c_channel {
+    ring_buffer_t *used;
+    ring_buffer_t *free[I2C_NUM_CLASSES];   // One per size class
+    uint32_t stash[I2C_NUM_CLASSES];        // Local free list heads, see stashBuf
+} i2c_channel_t;
+
+// Empty stash
+#define I2C_STASH_NONE UINT32_MAX
+
+// Per-bus transport state. A bus that is not in use has no rings.
+typedef struct i2c_bus_transport {
+    i2c_channel_t req;      // Server -> driver
+    i2c_channel_t ret;      // Driver -> server
+    inline_pool_t pool;     // Driver side copies of inline requests
+} i2c_bus_transport_t;
+
+static i2c_bus_transport_t transport[I2C_NUM_BUSES];
+
+static const uint32_t busRingSz[I2C_NUM_BUSES] = {
+    I2C_M0_RING_SZ, I2C_M1_RING_SZ, I2C_M2_RING_SZ, I2C_M3_RING_SZ
+};
+
+// Rings of a bus within i2c_rings: the request used ring and its free rings,
+// then the same again for returns.
+#define I2C_RING_USED 0
+#define I2C_RING_FREE(c) (1 + (c))
+#define I2C_RING_REQ 0
+#define I2C_RING_RET (I2C_RINGS_PER_BUS / 2)
+
+static inline ring_buffer_t *ringAddr(int bus, int kind) {
+    return (ring_buffer_t *) (i2c_rings + I2C_RING_STRIDE * (bus * I2C_RINGS_PER_BUS + kind));
+}
+
+// Number of buffers of class c behind each free ring of a bus
+static inline uint32_t classBufs(int bus, int c) {
+    uint32_t n = ring_roundup_size(busRingSz[bus]) >> bufClasses[c].shift;
+    return n ? n : 1;
+}
+
+/**
+ * Look up the transport state for a bus.
+ * @return NULL if the bus does not exist or is not in use.
+ */
+static inline i2c_bus_transport_t *busTransport(int bus) {
+    if ((unsigned int) bus >= I2C_NUM_BUSES || !transport[bus].req.used) {
+        return NULL;
+    }
+    return &transport[bus];
+}
+
+/**
+ * Take a buffer of at least `size` bytes from a channel. Falls back to a larger
+ * class if the best fitting one has run dry.
+ * @return the class of the buffer, or -1 if there is none.
+ */
+static inline int takeBuf(i2c_channel_t *ch, size_t size, uint32_t *offset) {
+    int c = sizeClass(size);
+    if (c < 0) {
+        printf("transport: Requested buffer size %zu too large\n", size);
+        return -1;
+    }
+    for (; c < I2C_NUM_CLASSES; c++) {
+        if (ch->stash[c] != I2C_STASH_NONE) {
+            *offset = ch->stash[c];
+            ch->stash[c] = *(uint32_t *) bufAddr(*offset);
+            return c;
+        }
+        unsigned int len;
+        if (dequeue(ch->free[c], offset, &len) != 0) {
+            continue;
+        }
+        if (bufClass(*offset) != c) {
+            sel4cp_dbg_puts("transport: Dropping out of range buffer!\n");
+            return -1;
+        }
+        return c;
+    }
+    return -1;
+}
+
+/**
+ * Hand a buffer back to the free ring of its class.
+ * @return 0 on success, -1 if buf is not a driver_bufs buffer.
+ */
+static inline int giveBuf(i2c_channel_t *ch, volatile uint8_t *buf) {
+    if ((uintptr_t) buf < driver_bufs) {
+        return -1;
+    }
+    uint32_t offset = bufOffset(buf);
+    int c = bufClass(offset);
+    if (c < 0) {
+        return -1;
+    }
+    return enqueue(ch->free[c], offset, bufClasses[c].sz);
+}
+
+/**
+ * Keep a buffer taken from a free ring that was never published. Only the far
+ * end of the channel produces onto its free rings, so the buffer is chained
+ * through its first word onto a local list instead, which takeBuf empties
+ * before going back to the ring.
+ */
+static inline void stashBuf(i2c_channel_t *ch, uint32_t offset, int c) {
+    *(uint32_t *) bufAddr(offset) = ch->stash[c];
+    ch->stash[c] = offset;
+}
+
+static inline uint8_t *inlineAlloc(inline_pool_t *pool) {
+    for (int i = 0; i < I2C_INLINE_BUFS; i++) {
+        if (!(pool->in_use & (1U << i))) {
+            pool->in_use |= (1U << i);
+            return pool->bufs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Return a buffer to its inline pool.
+ * @return 1 if the buffer came from this pool, 0 if it lives in driver_bufs.
+ */
+static inline int inlineFree(inline_pool_t *pool, volatile uint8_t *buf) {
+    uintptr_t base = (uintptr_t) pool->bufs;
+    if ((uintptr_t) buf < base || (uintptr_t) buf >= base + sizeof(pool->bufs)) {
+        return 0;
+    }
+    pool->in_use &= ~(1U << (((uintptr_t) buf - base) / I2C_INLINE_BUF_SZ));
+    return 1;
+}
+
+/**
+ * Populate a free ring with `n` buffers of class c, taken from driver_bufs
+ * starting at offset `next`.
+ * @return the offset of the first unused byte in driver_bufs.
+ */
+static uint32_t fillFreeRing(ring_buffer_t *ring, int c, uint32_t n, uint32_t next) {
+    uint32_t sz = bufClasses[c].sz;
+    uint32_t bufs[I2C_BATCH_MAX];
+    unsigned int lens[I2C_BATCH_MAX];
+    uint32_t i = 0;
+    while (i < n) {
+        unsigned int batch = 0;
+        while (batch < I2C_BATCH_MAX && i + batch < n) {
+            if (next + sz > I2C_DRIVER_BUFS_SZ) {
+                break;
+            }
+            bufs[batch] = next;
+            lens[batch] = sz;
+            next += sz;
+            batch++;
+        }
+        if (!batch) {
+            printf("transport: driver_bufs exhausted, ring only has %u of %u buffers\n", i, n);
+            break;
+        }
+        enqueue_batch(ring, bufs, lens, batch);
+        i += batch;
+    }
+    return next;
+}
+
+static void initChannel(i2c_channel_t *ch, int bus, int dir, int buffer_init) {
+    ch->used = ringAddr(bus, dir + I2C_RING_USED);
+    for (int c = 0; c < I2C_NUM_CLASSES; c++) {
+        ch->free[c] = ringAddr(bus, dir + I2C_RING_FREE(c));
+        ch->stash[c] = I2C_STASH_NONE;
+    }
+    if (!buffer_init) {
+        return;
+    }
+
+    // Free rings are polled, and only signalled while the driver waits on
+    // return buffers (see retBufRequestFree). Consumers of used rings start
+    // out idle.
+    ring_buffer_init(ch->used, busRingSz[bus], 1);
+    for (int c = 0; c < I2C_NUM_CLASSES; c++) {
+        ring_buffer_init(ch->free[c], classBufs(bus, c), 0);
+    }
+}
+
 void i2cTransportInit(int buffer_init) {
     sel4cp_dbg_puts("Initialising i2c transport layer => ");
     if (buffer_init) {
@@ -44,215 +287,411 @@ void i2cTransportInit(int buffer_init) {
     } else {
         sel4cp_dbg_puts("Not initialising buffers\n");
     }
+
+    // Lay out the class sections of driver_bufs. Each holds the buffers of its
+    // class for both directions of every bus in use.
+    uint32_t next = 0;
+    for (int c = 0; c < I2C_NUM_CLASSES; c++) {
+        classBase[c] = next;
+        for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+            if (busRingSz[bus]) {
+                next += 2 * classBufs(bus, c) * bufClasses[c].sz;
+            }
+        }
+    }
+    classBase[I2C_NUM_CLASSES] = next;
+    if (next > I2C_DRIVER_BUFS_SZ) {
+        printf("transport: buffer pools need %u bytes but driver_bufs only has %u!\n",
+               next, I2C_DRIVER_BUFS_SZ);
+        classBase[I2C_NUM_CLASSES] = I2C_DRIVER_BUFS_SZ;
+    }
+
     // Initialise rings
-    ring_init(&m2ReqRing, (ring_buffer_t *) m2_req_free, (ring_buffer_t *) m2_req_used, buffer_init);
-    ring_init(&m2RetRing, (ring_buffer_t *) m2_ret_free, (ring_buffer_t *) m2_ret_used, buffer_init);
-    ring_init(&m3ReqRing, (ring_buffer_t *) m3_req_free, (ring_buffer_t *) m3_req_used, buffer_init);
-    ring_init(&m3RetRing, (ring_buffer_t *) m3_ret_free, (ring_buffer_t *) m3_ret_used, buffer_init);
-
-    // If the caller is initialising, also populate the free buffers.
-    // Since all buffers are back to back in memory, need to offset each ring's buffers
-    // NOTE: To extend this code for more than 2 i2c masters the memory mapping will need to be adjusted.
+    for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        if (!busRingSz[bus]) {
+            continue;
+        }
+        if (RING_BUFFER_BYTES(ring_roundup_size(busRingSz[bus])) > I2C_RING_STRIDE) {
+            printf("transport: ring of %u entries does not fit its region!\n", busRingSz[bus]);
+            continue;
+        }
+        initChannel(&transport[bus].req, bus, I2C_RING_REQ, buffer_init);
+        initChannel(&transport[bus].ret, bus, I2C_RING_RET, buffer_init);
+    }
+
+    // If the caller is initialising, also populate the free rings from each
+    // class section in turn.
     if (buffer_init) {
-        for (int i = 0; i < I2C_BUF_COUNT; i++) {
-            enqueue_free(&m2ReqRing, (uintptr_t) driver_bufs + (i * I2C_BUF_SZ), I2C_BUF_SZ);
-            enqueue_free(&m2RetRing, (uintptr_t) driver_bufs + (I2C_BUF_SZ * (i + I2C_BUF_COUNT)), I2C_BUF_SZ);
-            enqueue_free(&m3ReqRing, (uintptr_t) driver_bufs + (I2C_BUF_SZ * (i + 2 * I2C_BUF_COUNT)), I2C_BUF_SZ);
-            enqueue_free(&m3RetRing, (uintptr_t) driver_bufs + (I2C_BUF_SZ * (i + 3 * I2C_BUF_COUNT)), I2C_BUF_SZ);
+        for (int c = 0; c < I2C_NUM_CLASSES; c++) {
+            next = classBase[c];
+            for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+                if (!busTransport(bus)) {
+                    continue;
+                }
+                next = fillFreeRing(transport[bus].req.free[c], c, classBufs(bus, c), next);
+                next = fillFreeRing(transport[bus].ret.free[c], c, classBufs(bus, c), next);
+            }
         }
     }
 
 }
 
 
-req_buf_ptr_t allocReqBuf(int bus, size_t size, uint8_t *data, uint8_t client, uint8_t addr) {
-    // sel4cp_dbg_puts("transport: Allocating request buffer\n");
-    if (bus != 2 && bus != 3) {
-        return 0;
+int reserveReqBuf(int bus, uint8_t **ptr, size_t max) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t || !ptr) {
+        return -1;
     }
-    if (size > I2C_BUF_SZ - 2*sizeof(i2c_token_t)) {
-        printf("transport: Requested buffer size %zu too large\n", size);
-        return 0;
+
+    uint32_t offset;
+    if (takeBuf(&t->req, max + REQ_HDR_SZ, &offset) < 0) {
+        return -1;
     }
-    
-    // Allocate a buffer from the appropriate ring
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2ReqRing;
-    } else {
-        ring = &m3ReqRing;
+    *ptr = (uint8_t *) bufAddr(offset) + REQ_HDR_SZ;
+    return 0;
+}
+
+/**
+ * Find the driver_bufs offset of the buffer behind a pointer handed out by
+ * reserveReqBuf.
+ * @return the class of the buffer, or -1 if ptr did not come from reserveReqBuf.
+ */
+static inline int reservedOffset(uint8_t *ptr, uint32_t *offset) {
+    uintptr_t p = (uintptr_t) ptr;
+    if (p < driver_bufs + REQ_HDR_SZ) {
+        return -1;
     }
-    uintptr_t buf;
-    unsigned int sz;
-    int ret = dequeue_free(ring, &buf, &sz);
-    if (ret != 0) {
-        return 0;
+    *offset = p - REQ_HDR_SZ - driver_bufs;
+    return bufClass(*offset);
+}
+
+int commitReqBuf(int bus, uint8_t *ptr, size_t len, uint8_t client, uint8_t addr) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    uint32_t offset;
+    int c;
+    if (!t || (c = reservedOffset(ptr, &offset)) < 0) {
+        return -1;
+    }
+    if (len + REQ_HDR_SZ > bufClasses[c].sz) {
+        abortReqBuf(bus, ptr);
+        return -1;
     }
 
     // Load the client ID and i2c address into first two bytes of buffer
-    *(uint8_t *) buf = client;
-    *(uint8_t *) (buf + sizeof(uint8_t)) = addr;
+    uint8_t *buf = ptr - REQ_HDR_SZ;
+    buf[0] = client;
+    buf[1] = addr;
 
-    // Copy the data into the buffer
-    memcpy((void *) buf + 2*sizeof(i2c_token_t), data, size);
-    
-    // print buffer
-    for (int i = 0; i < size + 2*sizeof(uint8_t); i++) {
-        printf("%x ", *(uint8_t *) (buf + i));
+    if (enqueue(t->req.used, offset, len + REQ_HDR_SZ) != 0) {
+        stashBuf(&t->req, offset, c);
+        return -1;
     }
-    printf("\n");
-    // Enqueue the buffer
-    ret = enqueue_used(ring, buf, size + 2*sizeof(uint8_t));
-    printf("transport: Allocated request buffer %p storing %u bytes\n", buf, size);
-    if (ret != 0) {
-        enqueue_free(ring, buf, I2C_BUF_SZ);
+    return 0;
+}
+
+int abortReqBuf(int bus, uint8_t *ptr) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    uint32_t offset;
+    int c;
+    if (!t || (c = reservedOffset(ptr, &offset)) < 0) {
+        return -1;
+    }
+    stashBuf(&t->req, offset, c);
+    return 0;
+}
+
+int allocReqBuf(int bus, size_t size, uint8_t *data, uint8_t client, uint8_t addr) {
+    // sel4cp_dbg_puts("transport: Allocating request buffer\n");
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
+        return -1;
+    }
+
+    // Small requests travel in the ring itself
+    if (size <= I2C_INLINE_MAX) {
+        return enqueue_inline(t->req.used, INLINE_TAG(client, addr), data, size);
+    }
+
+    uint8_t *buf;
+    if (reserveReqBuf(bus, &buf, size)) {
+        return -1;
+    }
+    memcpy(buf, data, size);
+    return commitReqBuf(bus, buf, size, client, addr);
+}
+
+int allocReqBufs(int bus, int count, const i2c_req_t *reqs) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
         return 0;
     }
-    
-    return buf;
+    if (count > I2C_BATCH_MAX) {
+        count = I2C_BATCH_MAX;
+    }
+    ring_buffer_t *used = t->req.used;
+
+    // Take a data buffer for everything too big to go inline, stopping at the
+    // first request we do not have a buffer or ring space for so that requests
+    // stay in order.
+    uint32_t space = ring_space(used, count * RING_INLINE_SLOTS(I2C_INLINE_MAX));
+    uint32_t bufs[I2C_BATCH_MAX];
+    uint32_t slots = 0;
+    int n;
+    for (n = 0; n < count; n++) {
+        int inl = reqs[n].size <= I2C_INLINE_MAX;
+        uint32_t need = inl ? RING_INLINE_SLOTS(reqs[n].size) : 1;
+        if (slots + need > space) {
+            break;
+        }
+        if (!inl && takeBuf(&t->req, reqs[n].size + REQ_HDR_SZ, &bufs[n]) < 0) {
+            break;
+        }
+        slots += need;
+    }
+
+    // Load and publish them all in one go
+    uint32_t slot = 0;
+    for (int i = 0; i < n; i++) {
+        if (reqs[i].size <= I2C_INLINE_MAX) {
+            slot += ring_write_inline(used, slot, INLINE_TAG(reqs[i].client, reqs[i].addr),
+                                      reqs[i].data, reqs[i].size);
+            continue;
+        }
+        uintptr_t buf = bufAddr(bufs[i]);
+        *(uint8_t *) buf = reqs[i].client;
+        *(uint8_t *) (buf + sizeof(uint8_t)) = reqs[i].addr;
+        memcpy((void *) buf + REQ_HDR_SZ, reqs[i].data, reqs[i].size);
+
+        buff_desc_t *desc = ring_produce_slot(used, slot++);
+        desc->offset = bufs[i];
+        desc->len = reqs[i].size + REQ_HDR_SZ;
+        desc->flags = 0;
+    }
+    ring_produce(used, slot);
+
+    return n;
 }
 
-ret_buf_ptr_t getRetBuf(int bus) {
+ret_buf_ptr_t getRetBuf(int bus, size_t size) {
     // sel4cp_dbg_puts("transport: Getting return buffer\n");
-    if (bus != 2 && bus != 3) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
         return 0;
     }
 
-    
-    // Allocate a buffer from the appropriate ring
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2RetRing;
-    } else {
-        ring = &m3RetRing;
-    }
-    uintptr_t buf;
-    unsigned int sz;
-    int ret = dequeue_free(ring, &buf, &sz);
-    if (ret != 0) {
+    uint32_t offset;
+    if (takeBuf(&t->ret, size, &offset) < 0) {
         sel4cp_dbg_puts("transport: Failed to get return buffer due to empty free ring!\n");
         return 0;
     }
-    printf("transport: Got return buffer %p\n", buf);
-    return buf;
+    return (ret_buf_ptr_t) bufAddr(offset);
 }
 
 int pushRetBuf(int bus, ret_buf_ptr_t buf, size_t size) {
     // sel4cp_dbg_puts("transport: pushign return buffer\n");
-    if (bus != 2 && bus != 3) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
         return 0;
     }
-    if (size > I2C_BUF_SZ || !buf) {
+    if (!buf) {
         return 0;
     }
-    
-    // Allocate a buffer from the appropriate ring
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2RetRing;
-    } else {
-        ring = &m3RetRing;
+    int c = bufClass(bufOffset(buf));
+    if (c < 0 || size > bufClasses[c].sz) {
+        return 0;
     }
 
     // Enqueue the buffer
-    int ret = enqueue_used(ring, (uintptr_t)buf, size);
+    int ret = enqueue(t->ret.used, bufOffset(buf), size);
     if (ret != 0) {
         return 0;
     }
     return -1;
 }
 
-static inline uintptr_t popBuf(ring_handle_t *ring, size_t *sz) {
-    uintptr_t buf;
-    int ret = dequeue_used(ring, &buf, sz);
-    printf("Popping buffer containing %zu bytes\n", *sz);
+static inline uintptr_t popBuf(i2c_channel_t *ch, size_t *sz) {
+    uint32_t offset;
+    unsigned int len;
+    int ret = dequeue(ch->used, &offset, &len);
     if (ret != 0) return 0;
-    return buf;
-} 
+    int c = bufClass(offset);
+    if (c < 0 || len > bufClasses[c].sz) {
+        sel4cp_dbg_puts("transport: Dropping out of range buffer!\n");
+        return 0;
+    }
+    *sz = len;
+    return bufAddr(offset);
+}
 
 req_buf_ptr_t popReqBuf(int bus, size_t *size) {
     // sel4cp_dbg_puts("transport: popping request buffer\n");
-    if (bus != 2 && bus != 3) {
+    req_buf_ptr_t buf;
+    if (popReqBufs(bus, &buf, size, 1) != 1) {
         return 0;
     }
+    return buf;
+}
 
-    // Allocate a buffer from the appropriate ring
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2ReqRing;
-    } else {
-        ring = &m3ReqRing;
+int popReqBufs(int bus, req_buf_ptr_t *bufs, size_t *sizes, int max) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
+        return 0;
+    }
+    if (max > I2C_BATCH_MAX) {
+        max = I2C_BATCH_MAX;
     }
-    return (req_buf_ptr_t) popBuf(ring, size);
-}
 
+    // Walk the published slots, copying inline requests out into the pool,
+    // then retire everything we took in one go.
+    ring_buffer_t *used = t->req.used;
+    uint32_t avail = ring_avail(used, max);
+    uint32_t slot = 0;
+    int n = 0;
+    while (n < max && slot < avail) {
+        buff_desc_t *desc = ring_consume_slot(used, slot);
+        if (desc->flags & RING_DESC_INLINE) {
+            uint8_t *buf = inlineAlloc(&t->pool);
+            if (!buf) {
+                break;
+            }
+            uint32_t tag;
+            unsigned int len;
+            slot += ring_read_inline(used, slot, &tag, buf + 2, &len);
+            buf[0] = tag & 0xFF;            // Client
+            buf[1] = (tag >> 8) & 0xFF;     // Address
+            bufs[n] = buf;
+            sizes[n] = len + 2;
+            n++;
+            continue;
+        }
+
+        slot++;
+        int c = bufClass(desc->offset);
+        if (c < 0 || desc->len > bufClasses[c].sz) {
+            sel4cp_dbg_puts("transport: Dropping out of range request buffer!\n");
+            continue;
+        }
+        bufs[n] = (req_buf_ptr_t) bufAddr(desc->offset);
+        sizes[n] = desc->len;
+        n++;
+    }
+    ring_consume(used, slot);
+    return n;
+}
 
 ret_buf_ptr_t popRetBuf(int bus, size_t *size) {
     // sel4cp_dbg_puts("transport: popping return buffer\n");
-    if (bus != 2 && bus != 3) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
         return 0;
     }
+    return (ret_buf_ptr_t) popBuf(&t->ret, size);
+}
 
-    // Allocate a buffer from the appropriate ring
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2RetRing;
-    } else {
-        ring = &m3RetRing;
-    }
-    return (ret_buf_ptr_t) popBuf(ring, size);
+int i2cBusEnabled(int bus) {
+    return busTransport(bus) != NULL;
 }
 
-int retBufEmpty(int bus) {
-    if (bus != 2 && bus != 3) {
-        return 0;
-    }
+int i2cBusConfigured(int bus) {
+    return (unsigned int) bus < I2C_NUM_BUSES && busRingSz[bus] != 0;
+}
 
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2RetRing;
-    } else {
-        ring = &m3RetRing;
+int retBufEmpty(int bus) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
+        return 1;
     }
-    return ring_empty(ring->used_ring);
+    return ring_empty(t->ret.used);
 }
 
 int reqBufEmpty(int bus) {
-    if (bus != 2 && bus != 3) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
         sel4cp_dbg_puts("transport: invalid bus requested on reqBufEmpty\n");
+        return 1;
+    }
+    return ring_empty(t->req.used);
+}
+
+int reqBufNeedsNotify(int bus) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
         return 0;
     }
+    return ring_require_signal(t->req.used);
+}
 
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2ReqRing;
-    } else {
-        ring = &m3ReqRing;
+int retBufNeedsNotify(int bus) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
+        return 0;
     }
-    return ring_empty(ring->used_ring);
+    return ring_require_signal(t->ret.used);
 }
 
+int reqBufRequestNotify(int bus) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
+        return 1;
+    }
+    return ring_request_signal(t->req.used);
+}
+
+int retBufRequestNotify(int bus) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
+        return 1;
+    }
+    return ring_request_signal(t->ret.used);
+}
+
+int retBufRequestFree(int bus, size_t size) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    int c = sizeClass(size);
+    if (!t || c < 0) {
+        return 1;
+    }
+    // Any class that fits will do, so wait on all of them
+    int idle = 1;
+    for (; c < I2C_NUM_CLASSES; c++) {
+        if (!ring_request_signal(t->ret.free[c])) {
+            idle = 0;
+        }
+    }
+    return idle;
+}
+
+int retBufFreeNeedsNotify(int bus) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
+        return 0;
+    }
+    int notify = 0;
+    for (int c = 0; c < I2C_NUM_CLASSES; c++) {
+        if (ring_require_signal(t->ret.free[c])) {
+            notify = 1;
+        }
+    }
+    return notify;
+}
 
 int releaseReqBuf(int bus, req_buf_ptr_t buf) {
     // sel4cp_dbg_puts("transport: releasing request buffer\n");
-    if (bus != 2 && bus != 3) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
         return 0;
     }
     if (!buf) {
         return 0;
     }
-    
-    // Allocate a buffer from the appropriate ring
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2ReqRing;
-    } else {
-        ring = &m3ReqRing;
+
+    // Requests that came inline never belonged to the free ring
+    if (inlineFree(&t->pool, buf)) {
+        return -1;
     }
 
     // Enqueue the buffer
-    int ret = enqueue_free(ring, (uintptr_t)buf, I2C_BUF_SZ);
-    if (ret != 0) {
+    if (giveBuf(&t->req, buf) != 0) {
         return 0;
     }
     return -1;
@@ -260,25 +699,17 @@ int releaseReqBuf(int bus, req_buf_ptr_t buf) {
 
 int releaseRetBuf(int bus, ret_buf_ptr_t buf) {
     // sel4cp_dbg_puts("transport: releasing return buffer\n");
-    if (bus != 2 && bus != 3) {
+    i2c_bus_transport_t *t = busTransport(bus);
+    if (!t) {
         return 0;
     }
     if (!buf) {
         return 0;
     }
-    
-    // Allocate a buffer from the appropriate ring
-    ring_handle_t *ring;
-    if (bus == 2) {
-        ring = &m2RetRing;
-    } else {
-        ring = &m3RetRing;
-    }
 
     // Enqueue the buffer
-    int ret = enqueue_free(ring, (uintptr_t)buf, I2C_BUF_SZ);
-    if (ret != 0) {
+    if (giveBuf(&t->ret, buf) != 0) {
         return 0;
     }
     return -1;
-}
\ No newline at end of file
+}
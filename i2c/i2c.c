@@ -15,6 +15,7 @@
 #include "sw_shared_ringbuffer.h"
 #include "printf.h"
 #include "i2c-transport.h"
+#include "i2c-prog.h"
 #include "i2c.h"
 
 
@@ -25,6 +26,151 @@ i2c_security_list_t security_list1[I2C_SECURITY_LIST_SZ];
 i2c_security_list_t security_list2[I2C_SECURITY_LIST_SZ];
 i2c_security_list_t security_list3[I2C_SECURITY_LIST_SZ];
 
+// Fastest I2C_SPEED_* each claimed device supports, per bus and address
+#define SPEED_UNSET 0xFF    // No preference: run at whatever the bus is at
+uint8_t device_speed[I2C_NUM_BUSES][I2C_SECURITY_LIST_SZ];
+
+// Speed of each bus once everything queued on it so far has run
+uint8_t bus_speed[I2C_NUM_BUSES];
+
+/**
+ * Security list for a bus. Indexed by address; each entry holds the channel of
+ * the client that claimed it, or 0 if it is free.
+*/
+static inline i2c_security_list_t *securityList(int bus) {
+    switch (bus) {
+        case 0:
+            return security_list0;
+        case 1:
+            return security_list1;
+        case 2:
+            return security_list2;
+        case 3:
+            return security_list3;
+    }
+    return NULL;
+}
+
+/**
+ * Notify the driver that services a bus.
+*/
+static inline void wakeDriver(int bus) {
+#ifdef I2C_DRIVER_PER_BUS
+    sel4cp_notify(DRIVER_BUS_NOTIFY_ID(bus));
+#else
+    sel4cp_notify(DRIVER_NOTIFY_ID);
+#endif
+}
+
+/**
+ * Let the driver know there are new requests on a bus. Only actually notifies
+ * if the driver has gone idle on that bus, otherwise it will find them itself.
+*/
+static inline void notifyDriver(int bus) {
+    if (reqBufNeedsNotify(bus)) {
+        wakeDriver(bus);
+    }
+}
+
+/**
+ * Queue a change of clock speed on a bus. Requests queued before it finish at
+ * the old speed. The driver only answers if the speed is invalid.
+ * @param speed I2C_SPEED_* mode
+ * @return 0 on success, -1 if the bus is full.
+*/
+static inline int setBusSpeed(int bus, uint8_t speed) {
+    i2c_token_t request[3] = {
+        I2C_TK_SPEED,
+        speed,
+        I2C_TK_END,
+    };
+    if (allocReqBuf(bus, 3, request, 0, 0)) {
+        return -1;
+    }
+    bus_speed[bus] = speed;
+    notifyDriver(bus);
+    return 0;
+}
+
+/**
+ * Make sure a bus will be running at the speed of a device by the time a
+ * request queued next reaches it. Only queues a change when the device needs a
+ * different speed to whatever was queued last, so runs of requests to devices
+ * of the same speed never touch the clock. Every path that queues a
+ * transaction for a device calls this first.
+ * @return 0 on success, -1 if the bus does not exist or is full.
+*/
+static inline int matchSpeed(int bus, uint8_t addr) {
+    if ((unsigned int) bus >= I2C_NUM_BUSES) {
+        return -1;
+    }
+    if (addr >= I2C_SECURITY_LIST_SZ) {
+        return 0;
+    }
+    uint8_t speed = device_speed[bus][addr];
+    if (speed == SPEED_UNSET || speed == bus_speed[bus]) {
+        return 0;
+    }
+    return setBusSpeed(bus, speed);
+}
+
+/**
+ * Queue a run of a compiled program on a bus on behalf of a client. Programs
+ * are shared, so the client must hold the address the program talks to.
+ * @return 0 on success, -1 if the program does not exist, the client has not
+ *         claimed its address on the bus or the bus is full.
+*/
+static inline int runProgram(int bus, int id, sel4cp_channel client) {
+    const volatile i2c_prog_t *prog = i2cProgGet(id);
+    if (!prog) {
+        return -1;
+    }
+    i2c_security_list_t *list = securityList(bus);
+    if (!list || prog->addr >= I2C_SECURITY_LIST_SZ || list[prog->addr] != client) {
+        return -1;
+    }
+    i2c_token_t request[3] = {
+        I2C_TK_PROG,
+        id,
+        I2C_TK_END,
+    };
+    if (matchSpeed(bus, prog->addr) || allocReqBuf(bus, 3, request, client, prog->addr)) {
+        return -1;
+    }
+    notifyDriver(bus);
+    return 0;
+}
+
+/**
+ * Claim an address on a bus for a client.
+ * @param speed Fastest I2C_SPEED_* the device supports. The bus is switched to
+ *              it before each transaction with the device.
+ * @return 0 on success, -1 if the address is invalid or already claimed.
+*/
+static inline int claimAddr(int bus, uint8_t addr, uint8_t speed, sel4cp_channel client) {
+    i2c_security_list_t *list = securityList(bus);
+    if (!list || addr >= I2C_SECURITY_LIST_SZ || list[addr] || speed > I2C_SPEED_FASTPLUS) {
+        return -1;
+    }
+    list[addr] = client;
+    device_speed[bus][addr] = speed;
+    return 0;
+}
+
+/**
+ * Release an address a client has claimed.
+ * @return 0 on success, -1 if the client does not hold the address.
+*/
+static inline int releaseAddr(int bus, uint8_t addr, sel4cp_channel client) {
+    i2c_security_list_t *list = securityList(bus);
+    if (!list || addr >= I2C_SECURITY_LIST_SZ || list[addr] != client) {
+        return -1;
+    }
+    list[addr] = 0;
+    device_speed[bus][addr] = SPEED_UNSET;
+    return 0;
+}
+
 static inline void testds3231() {
     uint8_t addr = 0x68;
     uint8_t cid = 1;
@@ -41,12 +187,11 @@ static inline void testds3231() {
         I2C_TK_STOP,
         I2C_TK_END,
     };
-    req_buf_ptr_t ret = allocReqBuf(2, 10, request, cid, addr);
-    if (!ret) {
+    if (matchSpeed(2, addr) || allocReqBuf(2, 10, request, cid, addr)) {
         sel4cp_dbg_puts("test: failed to allocate req buffer\n");
         return;
     }
-    sel4cp_notify(DRIVER_NOTIFY_ID);
+    notifyDriver(2);
 
     // Try read back
     i2c_token_t request2[10] = {
@@ -61,12 +206,46 @@ static inline void testds3231() {
         I2C_TK_STOP,
         I2C_TK_END,
     };
-    ret = allocReqBuf(2, 10, request2, cid, addr);
-    if (!ret) {
+    if (matchSpeed(2, addr) || allocReqBuf(2, 10, request2, cid, addr)) {
         sel4cp_dbg_puts("test: failed to allocate req buffer\n");
         return;
     }
-    sel4cp_notify(DRIVER_NOTIFY_ID);
+    notifyDriver(2);
+}
+
+static inline void testProg() {
+    uint8_t cid = 1;
+
+    // Compile the DS3231 year read once, then run it repeatedly
+    i2c_token_t request[10] = {
+        I2C_TK_START,
+        I2C_TK_ADDRW,
+        I2C_TK_DAT,
+        0x6,
+        I2C_TK_START,
+        I2C_TK_ADDRR,
+        I2C_TK_DAT,
+        I2C_TK_DATA_END,
+        I2C_TK_STOP,
+        I2C_TK_END,
+    };
+    int id = i2cProgCompile(request, 10, 0x68);
+    if (id < 0) {
+        sel4cp_dbg_puts("test: failed to compile program\n");
+        return;
+    }
+    // Only the holder of the address may run it
+    if (claimAddr(2, 0x68, I2C_SPEED_FAST, cid)) {
+        sel4cp_dbg_puts("test: failed to claim address\n");
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (runProgram(2, id, cid)) {
+            sel4cp_dbg_puts("test: failed to run program\n");
+            break;
+        }
+    }
+    releaseAddr(2, 0x68, cid);
 }
 
 static inline void test() {
@@ -87,8 +266,7 @@ static inline void test() {
     };
     // sel4cp_dbg_puts("test: allocating req buffer\n");
     // Write 1,2,3 to address 0x20
-    // req_buf_ptr_t ret = allocReqBuf(2, 11, request, cid, addr);
-    // if (!ret) {
+    // if (allocReqBuf(2, 11, request, cid, addr)) {
     //     sel4cp_dbg_puts("test: failed to allocate req buffer\n");
     //     return;
     // }
@@ -107,104 +285,58 @@ static inline void test() {
         I2C_TK_STOP,
         I2C_TK_END,
     };
-    // Write 1,2,3 to address 0x20
-    req_buf_ptr_t ret = allocReqBuf(2, 10, request2, cid, addr);
-    if (!ret) {
-        sel4cp_dbg_puts("test: failed to allocate req buffer\n");
-        return;
-    }
-    sel4cp_notify(DRIVER_NOTIFY_ID);
-    
-    ret = allocReqBuf(2, 11, request, cid, addr);
-    if (!ret) {
-        sel4cp_dbg_puts("test: failed to allocate req buffer\n");
-        return;
-    }
-    sel4cp_notify(DRIVER_NOTIFY_ID);
-    
-    ret = allocReqBuf(2, 10, request2, cid, addr);
-    if (!ret) {
-        sel4cp_dbg_puts("test: failed to allocate req buffer\n");
+    // Queue all three as one burst so the driver sees a single ring update
+    i2c_req_t burst[3] = {
+        { .data = request2, .size = 10, .client = cid, .addr = addr },
+        { .data = request,  .size = 11, .client = cid, .addr = addr },
+        { .data = request2, .size = 10, .client = cid, .addr = addr },
+    };
+    if (matchSpeed(2, addr) || allocReqBufs(2, 3, burst) != 3) {
+        sel4cp_dbg_puts("test: failed to allocate req buffers\n");
         return;
     }
-    sel4cp_notify(DRIVER_NOTIFY_ID);
+    notifyDriver(2);
 }
 
 static inline void testLong() {
     uint8_t cid = 1; // client id
     uint8_t addr = 0x68; // address
-    i2c_token_t request[64] = {
-        I2C_TK_START,
-        I2C_TK_ADDRW,
-        I2C_TK_DAT,
-        0x06,
-        I2C_TK_DAT,
-        0x01,
-        I2C_TK_DAT,
-        0x02,
-        I2C_TK_DAT,
-        0x03,
-        I2C_TK_DAT,
-        0x04,
-        I2C_TK_DAT,
-        0x05,
-        I2C_TK_DAT,
-        0x06,
-        I2C_TK_DAT,
-        0x07,
-        I2C_TK_DAT,
-        0x08,
-        I2C_TK_DAT,
-        0x09,
-        I2C_TK_DAT,
-        0x0A,
-        I2C_TK_DAT,
-        0x0B,
-        I2C_TK_DAT,
-        0x0C,
-        I2C_TK_DAT,
-        0x0D,
-        I2C_TK_DAT,
-        0x0E,
-        I2C_TK_DAT,
-        0x0F,
-        I2C_TK_DAT,
-        0x10,
-        I2C_TK_DAT,
-        0x12,
-        I2C_TK_DAT,
-        0x13,
-        I2C_TK_DAT,
-        0x14,
-        I2C_TK_DAT,
-        0x15,
-        I2C_TK_DAT,
-        0x16,
-        I2C_TK_DAT,
-        0x17,
-        I2C_TK_DAT,
-        0x18,
-        I2C_TK_DAT,
-        0x19,
-        I2C_TK_DAT,
-        0x1A,
-        I2C_TK_DAT,
-        0x1B,
-        I2C_TK_DAT,
-        0x1C,
-        I2C_TK_DAT,
-        0x1D,
-        I2C_TK_DAT,
-        0x1E,
-        I2C_TK_STOP,
-        I2C_TK_END,
-    };
-    req_buf_ptr_t ret = allocReqBuf(2, 64, request, cid, addr);
-    if (!ret) {
+
+    // Build the request straight into the shared buffer
+    uint8_t *request;
+    if (reserveReqBuf(2, &request, 64)) {
         sel4cp_dbg_puts("test: failed to allocate req buffer\n");
         return;
     }
-    sel4cp_notify(DRIVER_NOTIFY_ID);
+    // Register 0x06 followed by 29 bytes of data, sent as runs of up to 8
+    uint8_t payload[30];
+    payload[0] = 0x06;
+    for (int j = 1; j < 30; j++) {
+        payload[j] = j;
+    }
+    size_t n = 0;
+    request[n++] = I2C_TK_START;
+    request[n++] = I2C_TK_ADDRW;
+    for (int p = 0; p < 30;) {
+        int run = (30 - p < I2C_TK_DATN_MAX) ? 30 - p : I2C_TK_DATN_MAX;
+        request[n++] = I2C_TK_DATN(run);
+        for (int j = 0; j < run; j++) {
+            request[n++] = payload[p++];
+        }
+    }
+    request[n++] = I2C_TK_STOP;
+    request[n++] = I2C_TK_END;
+    // The speed change has to go ahead of the request, so it is queued first
+    if (matchSpeed(2, addr)) {
+        abortReqBuf(2, request);
+        sel4cp_dbg_puts("test: failed to queue speed change\n");
+        return;
+    }
+    if (commitReqBuf(2, request, n, cid, addr)) {
+        sel4cp_dbg_puts("test: failed to queue req buffer\n");
+        return;
+    }
+    notifyDriver(2);
 }
 
 /**
@@ -220,10 +352,17 @@ void init(void) {
         security_list2[i] = 0;
         security_list3[i] = 0;
     }
+    for (int bus = 0; bus < I2C_NUM_BUSES; bus++) {
+        bus_speed[bus] = I2C_SPEED_FAST;   // Matching the driver's start up speed
+        for (int i = 0; i < I2C_SECURITY_LIST_SZ; i++) {
+            device_speed[bus][i] = SPEED_UNSET;
+        }
+    }
 
     // test();
     testds3231();
     // testLong();
+    // testProg();
 }
 
 /**
@@ -233,31 +372,41 @@ void init(void) {
 static inline void driverNotify(void) {
     printf("server: Notified by driver!\n");
     // Read the return buffer
-    // No way to know which interface generated notification, so we just try all of them
-    for (int i = 2; i < 4; i ++) {
-        if (retBufEmpty(i)) {
-            continue;
-        }
-        size_t *sz;
-        ret_buf_ptr_t ret = popRetBuf(i, &sz);
-        printf("ret buf first 4 bytes: %x %x %x %x\n", ret[0], ret[1], ret[2], ret[3]);
-        printf("server: Got return buffer %p\n", ret);
-        printf("bus = %i client = %i addr = %i sz=%u\n", *(uint8_t *) ret,
-        *(uint8_t *) (ret + sizeof(uint8_t)), *(uint8_t *) (ret + 2*sizeof(uint8_t)),
-        sz);
-
-        uint8_t err = ret[RET_BUF_ERR];
-        uint8_t err_tk = ret[RET_BUF_ERR_TK];
-        uint8_t client = ret[RET_BUF_CLIENT];
-        uint8_t addr = ret[RET_BUF_ADDR];
-
-        if (err) {
-            printf("server: Error %i on bus %i for client %i at token of type %i\n", err, i, client, addr);
-        } else {
-            printf("server: Success on bus %i for client %i at address %i\n", i, client, addr);
-        }
+    // No way to know which interface generated notification, so we just try all of them.
+    // Drain each bus, then ask the driver to notify us next time before moving on.
+    for (int i = 0; i < I2C_NUM_BUSES; i ++) {
+        int released = 0;
+        do {
+            while (!retBufEmpty(i)) {
+                size_t sz;
+                ret_buf_ptr_t ret = popRetBuf(i, &sz);
+                printf("ret buf first 4 bytes: %x %x %x %x\n", ret[0], ret[1], ret[2], ret[3]);
+                printf("server: Got return buffer %p\n", ret);
+                printf("bus = %i client = %i addr = %i sz=%zu\n", *(uint8_t *) ret,
+                *(uint8_t *) (ret + sizeof(uint8_t)), *(uint8_t *) (ret + 2*sizeof(uint8_t)),
+                sz);
+
+                uint8_t err = ret[RET_BUF_ERR];
+                uint8_t err_tk = ret[RET_BUF_ERR_TK];
+                uint8_t client = ret[RET_BUF_CLIENT];
+                uint8_t addr = ret[RET_BUF_ADDR];
+
+                if (err) {
+                    printf("server: Error %i on bus %i for client %i at token %i\n", err, i, client, err_tk);
+                } else {
+                    printf("server: Success on bus %i for client %i at address %i, read %zu bytes\n",
+                           i, client, addr, sz - RET_BUF_HDR_SZ);
+                }
+
+                releaseRetBuf(i, ret);
+                released = 1;
+            }
+        } while (!retBufRequestNotify(i));
 
-        releaseRetBuf(i, ret);
+        // The driver may be holding a request back until a return buffer frees up
+        if (released && retBufFreeNeedsNotify(i)) {
+            wakeDriver(i);
+        }
     }
 }
 
@@ -270,6 +419,14 @@ void notified(sel4cp_channel c) {
         case 2:
             // Client 1
             break;
+#ifdef I2C_DRIVER_PER_BUS
+        case DRIVER_BUS_NOTIFY_ID(0):
+        case DRIVER_BUS_NOTIFY_ID(1):
+        case DRIVER_BUS_NOTIFY_ID(2):
+        case DRIVER_BUS_NOTIFY_ID(3):
+            driverNotify();
+            break;
+#endif
     }
 }
 
@@ -280,13 +437,29 @@ seL4_MessageInfo_t protected(sel4cp_channel c, seL4_MessageInfo_t m) {
     // Determine the type of request
     uint64_t req = sel4cp_mr_get(I2C_PPC_REQTYPE);
     uint64_t arg1 = sel4cp_mr_get(1);   // Bus
-    uint64_t arg2 = sel4cp_mr_get(2);   // Address
+    uint64_t arg2 = sel4cp_mr_get(2);   // Address, or program ID for I2C_PPC_PROG_RUN
     switch (req) {
         case I2C_PPC_CLAIM:
-            // Claim an address
+            // Claim an address. The device's max speed is in the next register.
+            if (arg1 >= I2C_NUM_BUSES || arg2 >= I2C_SECURITY_LIST_SZ ||
+                sel4cp_mr_get(3) > I2C_SPEED_FASTPLUS ||
+                claimAddr(arg1, arg2, sel4cp_mr_get(3), c)) {
+                return sel4cp_msginfo_new(1, 0);
+            }
             break;
         case I2C_PPC_RELEASE:
             // Release an address
+            if (arg1 >= I2C_NUM_BUSES || arg2 >= I2C_SECURITY_LIST_SZ ||
+                releaseAddr(arg1, arg2, c)) {
+                return sel4cp_msginfo_new(1, 0);
+            }
+            break;
+        case I2C_PPC_PROG_RUN:
+            // Run a compiled program. The bus indexes the server's speed
+            // tables, so it is checked before anything else sees it.
+            if (arg1 >= I2C_NUM_BUSES || runProgram(arg1, arg2, c)) {
+                return sel4cp_msginfo_new(1, 0);
+            }
             break;
     }
 
@@ -21,6 +21,18 @@
 #define GPIO_PM5_X18 BIT(8) | BIT(9) | BIT(10) | BIT(11)
 #define GPIO_PM5_X_I2C 1
 
+// M0 and M1 are not on the ODROID C4 header, so they are routed out to a carrier
+// board: M0 on GPIOZ_0/1, M1 on GPIOX_10/11.
+#define GPIO_PINMUX_4 0xb4
+#define GPIO_PM4_X10 (BIT(8) | BIT(9) | BIT(10) | BIT(11))
+#define GPIO_PM4_X11 (BIT(12) | BIT(13) | BIT(14) | BIT(15))
+#define GPIO_PM4_X_I2C 5
+
+#define GPIO_PINMUX_6 0xb6
+#define GPIO_PM6_Z0 (BIT(0) | BIT(1) | BIT(2) | BIT(3))
+#define GPIO_PM6_Z1 (BIT(4) | BIT(5) | BIT(6) | BIT(7))
+#define GPIO_PM6_Z_I2C 4
+
 #define GPIO_PINMUX_E 0xbe
 #define GPIO_PE_A14 BIT(27) | BIT(26) | BIT(25) | BIT(24)
 #define GPIO_PE_A15 BIT(31) | BIT(30) | BIT(29) | BIT(28)
@@ -28,14 +40,14 @@
 
 // Drive strengths
 #define GPIO_DS_2B     0xd3 // M2
-#define GPIO_DS_2B_X17 BIT(3) | BIT(2)
-#define GPIO_DS_2B_X18 BIT(1) | BIT(0)  // Also used for X19, for some reason
+#define GPIO_DS_2B_X17 (BIT(3) | BIT(2))
+#define GPIO_DS_2B_X18 (BIT(5) | BIT(4))
 #define GPIO_DS_2B_X17_SHIFT 2
 #define GPIO_DS_2B_X18_SHIFT 4
 
 #define GPIO_DS_5A     0xd4 // M3
-#define GPIO_DS_5A_A14 BIT(28) | BIT(29)
-#define GPIO_DS_5A_A15 BIT(30) | BIT(31)
+#define GPIO_DS_5A_A14 (BIT(28) | BIT(29))
+#define GPIO_DS_5A_A15 (BIT(30) | BIT(31))
 #define GPIO_DS_5A_A14_SHIFT 28
 #define GPIO_DS_5A_A15_SHIFT 30
 
@@ -44,6 +56,8 @@
 // Bias (pull up/down)
 #define GPIO_BIAS_2     0x3c    // GPIO bank X
 #define GPIO_BIAS_2_EN  0x4a    
+#define GPIO_BIAS_4     0x3e    // GPIO bank Z
+#define GPIO_BIAS_4_EN  0x4c
 #define GPIO_BIAS_5     0x3f    // GPIO bank A
 #define GPIO_BIAS_5_EN  0x4d
 
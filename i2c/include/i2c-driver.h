@@ -19,19 +19,46 @@
 #define WBUF_SZ_MAX 64
 #define RBUF_SZ_MAX 64
 
+// Bus speeds, as passed with I2C_TK_SPEED
+#define I2C_SPEED_STD       0   // Standard mode, 100 kHz
+#define I2C_SPEED_FAST      1   // Fast mode, 400 kHz
+#define I2C_SPEED_FASTPLUS  2   // Fast-mode plus, 1 MHz
+
 // Internal driver state for each bus
 typedef struct _i2c_bus_state {
-    uint16_t speed;         // Current programmed speed. Note that this stores the
-                            // actual speed, not the quarter clock delay.   
+    uint32_t speed;         // Current programmed speed. Note that this stores the
+                            // actual speed in Hz, not the quarter clock delay.
 } i2c_bus_t;
 
 
 typedef uint8_t i2c_addr_t;         // 7-bit addressing
 
 
+// Hybrid polling. After starting a load of the list processor, the driver spins
+// on the control register for up to this many reads waiting for it to finish
+// before leaving the run to the completion IRQ. Short transactions then skip the
+// IRQ, ack and context switch entirely. 0 disables polling on that bus.
+#ifndef I2C_M0_POLL_BUDGET
+#define I2C_M0_POLL_BUDGET 0
+#endif
+#ifndef I2C_M1_POLL_BUDGET
+#define I2C_M1_POLL_BUDGET 0
+#endif
+#ifndef I2C_M2_POLL_BUDGET
+#define I2C_M2_POLL_BUDGET 0
+#endif
+#ifndef I2C_M3_POLL_BUDGET
+#define I2C_M3_POLL_BUDGET 0
+#endif
+
 // Driver-server interface
 #include "i2c-token.h"
 #define SERVER_NOTIFY_ID 1
 
+// Per-bus drivers leave the shared pad and clock setup to the i2c_pads PD and
+// hold off touching their master until it signals that setup is done.
+#define PADS_READY_ID 10                        // Driver end, matching i2c_per_bus.system
+#define PADS_DRIVER_NOTIFY_ID(bus) (1 + (bus))  // i2c_pads end
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2023, UNSW
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+// i2c-prog.h
+// Pre-compiled i2c transactions. The server compiles a token stream once into
+// the register values for each load of the list processor and keeps the result
+// in a program cache shared read-only with the driver. Clients then queue a
+// request containing just I2C_TK_PROG and the program ID, and the driver copies
+// the pre-built words straight into the hardware.
+
+#ifndef I2C_PROG_H
+#define I2C_PROG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "i2c-token.h"
+
+// Number of programs in the cache
+#define I2C_PROG_MAX 32
+
+// Loads of the list processor a single program may take
+#define I2C_PROG_MAX_CHUNKS 8
+
+// Shared region size (matching i2c.system)
+#define I2C_PROG_REGION_SZ 0x2000
+
+// Register values for one load of the list processor
+typedef struct i2c_chunk {
+    uint32_t tk_list0;
+    uint32_t tk_list1;
+    uint32_t wdata0;
+    uint32_t wdata1;
+    uint8_t rd_cnt;     // Bytes read by this chunk
+    uint8_t tk_cnt;     // Tokens used by this chunk
+    uint8_t wr_cnt;     // Bytes written by this chunk
+    uint8_t pad;
+} i2c_chunk_t;
+
+typedef struct i2c_prog {
+    uint8_t valid;      // Set once the program is ready to run
+    uint8_t addr;       // 7-bit target address it was compiled for
+    uint8_t nchunks;
+    uint8_t rd_cnt;     // Bytes read by the whole program
+    i2c_chunk_t chunks[I2C_PROG_MAX_CHUNKS];
+} i2c_prog_t;
+
+// Shared memory region holding I2C_PROG_MAX programs
+extern uintptr_t i2c_progs;
+
+// Position of the encoder in a token stream, carried between chunks. Start a
+// stream zeroed.
+typedef struct i2c_enc {
+    size_t pos;         // Offset of the next token to encode
+    uint8_t ddr;        // Data direction. 0 = write, 1 = read.
+    uint8_t run;        // Bytes of the data run at pos already encoded
+} i2c_enc_t;
+
+// Hardware runs a token stream needs, worked out before starting it
+typedef struct i2c_plan {
+    size_t runs;        // Loads of the list processor
+    size_t rd_cnt;      // Bytes read over all of them
+} i2c_plan_t;
+
+/**
+ * Encode the next load of the list processor from a token stream. This is the
+ * single place generic tokens are turned into hardware register values. Each
+ * chunk is packed until the token list, wdata or rdata registers are full,
+ * splitting data runs across chunks where needed. A START is never split from
+ * the address token that follows it.
+ *
+ * @param tokens: Token stream, END terminated
+ * @param len: Number of bytes in tokens
+ * @param enc: Encoder position, advanced past what was encoded
+ * @param chunk: Filled in with the register values
+ * @return 0 on success, -1 if the stream is malformed.
+ */
+int i2cEncodeChunk(const i2c_token_t *tokens, size_t len, i2c_enc_t *enc,
+                   i2c_chunk_t *chunk);
+
+/**
+ * Work out how many loads of the list processor a token stream takes and how
+ * many bytes it reads, without touching the hardware.
+ * @param tokens: Token stream, END terminated
+ * @param len: Number of bytes in tokens
+ * @param plan: Filled in with the result
+ * @return 0 on success, -1 if the stream is malformed or does nothing.
+ */
+int i2cPlan(const i2c_token_t *tokens, size_t len, i2c_plan_t *plan);
+
+/**
+ * Server side: compile a token stream into a free slot of the program cache.
+ * @param tokens: Token stream, END terminated
+ * @param len: Number of bytes in tokens
+ * @param addr: 7-bit i2c address the program talks to
+ * @return program ID, or -1 if the stream is malformed, too long or the cache is full.
+ */
+int i2cProgCompile(const i2c_token_t *tokens, size_t len, uint8_t addr);
+
+/**
+ * Server side: drop a program from the cache. Must not be called while a run of
+ * the program is still queued or in flight.
+ */
+void i2cProgFree(int id);
+
+/**
+ * Look up a compiled program.
+ * @return the program, or NULL if id is not a valid compiled program.
+ */
+const volatile i2c_prog_t *i2cProgGet(int id);
+
+#endif
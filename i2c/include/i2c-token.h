@@ -37,4 +37,18 @@ typedef uint8_t i2c_token_t;
 
 #define I2C_TK_DAT      0x7     // Read or write one byte - the byte after this is treated as payload.
 
+// Read or write X bytes, for X between 1 and 8 - under a write the X bytes after this are treated as
+// payload. Encoded as 0x8 | (X - 1), so 0x8-0xF are all DATN tokens.
+#define I2C_TK_DATN(X)          (0x8 | ((X) - 1))
+#define I2C_TK_DATN_MAX         8
+#define I2C_TK_IS_DATN(tk)      (((tk) & ~0x7) == 0x8)
+#define I2C_TK_DATN_LEN(tk)     (((tk) & 0x7) + 1)
+
+#define I2C_TK_PROG     0x10    // RUN PROGRAM: Run the pre-compiled program whose ID is in the next byte
+                                //              (see i2c-prog.h). Must be the only token in the request
+                                //              besides the terminating END.
+#define I2C_TK_SPEED    0x11    // SET SPEED: Reprogram the bus clock for the I2C_SPEED_* mode in the next
+                                //            byte, once all earlier requests have finished. Must be the
+                                //            only token in the request besides the terminating END.
+
 #endif
\ No newline at end of file
@@ -17,38 +17,85 @@
 #include <string.h>
 #include "i2c-token.h"
 
+// Request and return buffers come in size classes, and each is taken from the
+// smallest class that fits. I2C_BUF_SZ is the largest.
+#define I2C_NUM_CLASSES 3
+#define I2C_BUF_SZ_SMALL 32
+#define I2C_BUF_SZ_MEDIUM 128
 #define I2C_BUF_SZ 512
-#define I2C_BUF_COUNT 511
+
+// Number of EE domain i2c masters (M0-M3). Buses are numbered by master, and
+// every per-bus structure in the transport is indexed directly by bus number.
+#define I2C_NUM_BUSES 4
+
+// Ring depth for each bus. Rounded up to a power of two at init time, and can be
+// overridden per bus at build time (e.g. -DI2C_M3_RING_SZ=1024) to give a busy
+// bus a deeper ring without touching the others. A depth of 0 leaves the bus out
+// of the transport entirely. Each direction of a bus gets a free ring per size
+// class, backed by buffers in driver_bufs, so the total across all buses must
+// fit into I2C_DRIVER_BUFS_SZ.
+//
+// M0 and M1 are opt-in: bringing a bus up remuxes its pads (GPIOZ_0/1 and
+// GPIOX_10/11), which takes them from whatever else they are wired to. Their
+// timeout IRQs are not mapped yet either, so a transaction on them that stalls
+// with SCL held low never completes and wedges that bus's queue. Until those
+// IRQs are confirmed these buses have no timeout recovery.
+#ifndef I2C_M0_RING_SZ
+#define I2C_M0_RING_SZ 0
+#endif
+#ifndef I2C_M1_RING_SZ
+#define I2C_M1_RING_SZ 0
+#endif
+#ifndef I2C_M2_RING_SZ
+#define I2C_M2_RING_SZ 512
+#endif
+#ifndef I2C_M3_RING_SZ
+#define I2C_M3_RING_SZ 512
+#endif
+
+// Requests of at most this many bytes of tokens are carried inline in the request
+// ring instead of in a driver_bufs buffer
+#define I2C_INLINE_MAX RING_INLINE_MAX
+
+// Maximum number of buffers moved by a single batched transport call
+#define I2C_BATCH_MAX 16
+
+// Shared region sizes (matching i2c.system)
+#define I2C_RING_REGION_SZ 0x200000
+#define I2C_DRIVER_BUFS_SZ 0x200000
+
+// The ring region is split evenly between the rings of every bus, laid out bus
+// by bus as the request used ring and its per-class free rings, then the same for
+// returns. Ring `kind` of `bus` lives at
+// i2c_rings + I2C_RING_STRIDE * (bus * I2C_RINGS_PER_BUS + kind).
+#define I2C_RINGS_PER_BUS (2 * (1 + I2C_NUM_CLASSES))
+#define I2C_RING_STRIDE (I2C_RING_REGION_SZ / (I2C_NUM_BUSES * I2C_RINGS_PER_BUS))
 
 // Return buffer
 #define RET_BUF_ERR 0
 #define RET_BUF_ERR_TK 1
 #define RET_BUF_CLIENT 2
 #define RET_BUF_ADDR 3
+#define RET_BUF_HDR_SZ 4
 
 // Shared memory regions
-extern uintptr_t m2_req_free;
-extern uintptr_t m2_req_used;
-extern uintptr_t m3_req_free;
-extern uintptr_t m3_req_used;
-
-extern uintptr_t m2_ret_free;
-extern uintptr_t m2_ret_used;
-extern uintptr_t m3_ret_free;
-extern uintptr_t m3_ret_used;
+extern uintptr_t i2c_rings;
 extern uintptr_t driver_bufs;
 
-extern ring_handle_t m2ReqRing;
-extern ring_handle_t m2RetRing;
-extern ring_handle_t m3ReqRing;
-extern ring_handle_t m3RetRing;
-
 
 // Metadata is encoded differently in returns vs. requests so we
 // have two types for safety.
 typedef volatile uint8_t *ret_buf_ptr_t;
 typedef volatile uint8_t *req_buf_ptr_t;
 
+// A single request for allocReqBufs
+typedef struct i2c_req {
+    uint8_t *data;      // Token stream, END terminated
+    size_t size;        // Number of bytes in data
+    uint8_t client;     // Protection domain of the requesting client
+    uint8_t addr;       // 7-bit i2c address
+} i2c_req_t;
+
 /**
  * Initialise the transport layer. Sets up shared ring buffers
  * and their associated transport buffers.
@@ -61,18 +108,66 @@ void i2cTransportInit(int buffer_init);
  * Buffers are allocated from the free pool and loaded with data into the used pool.
  * 
  * The first two bytes of the buffer store the client ID and address respectively
- * to be used for bookkeeping.
+ * to be used for bookkeeping. The buffer comes from the smallest size class that
+ * holds the request. Requests of up to I2C_INLINE_MAX bytes are copied
+ * straight into the ring instead and never take a buffer from the free pool.
  * 
  * @note Expects that data is properly formatted with END token terminator.
  * 
  * @param bus: EE domain i2c master interface number
- * @param size: Size of the data to be loaded into the buffer. Max I2C_BUF_SZ
+ * @param size: Size of the data to be loaded into the buffer. Max I2C_BUF_SZ - 2
  * @param data: Pointer to the data to be loaded into the buffer
  * @param client: Protection domain of the client who requested this.
  * @param addr: 7-bit I2C address to be used for the transaction
- * @return Pointer to the buffer allocated for this request
+ * @return 0 on success, -1 on failure
+*/
+int allocReqBuf(int bus, size_t size, uint8_t *data, uint8_t client, uint8_t addr);
+
+/**
+ * Zero-copy alternative to `allocReqBuf`. Reserves a request buffer on `bus` and
+ * hands back a pointer to its token area in driver_bufs, so the caller can build
+ * the token stream in place. The buffer must then be passed to either
+ * `commitReqBuf` or `abortReqBuf`. Several buffers may be reserved at once.
+ *
+ * @param bus: EE domain i2c master interface number
+ * @param ptr: Set to the start of the token area on success
+ * @param max: Number of bytes of tokens the caller will write at most
+ * @return 0 on success, -1 on failure
+*/
+int reserveReqBuf(int bus, uint8_t **ptr, size_t max);
+
+/**
+ * Publish a buffer from `reserveReqBuf` to the driver.
+ *
+ * @param bus: Bus the buffer was reserved on
+ * @param ptr: Pointer returned by `reserveReqBuf`
+ * @param len: Number of bytes of tokens written, including the END token
+ * @param client: Protection domain of the client who requested this.
+ * @param addr: 7-bit I2C address to be used for the transaction
+ * @return 0 on success, -1 on failure. On failure the buffer is kept for the next
+ *         `reserveReqBuf`, as is one given to `abortReqBuf`.
+*/
+int commitReqBuf(int bus, uint8_t *ptr, size_t len, uint8_t client, uint8_t addr);
+
+/**
+ * Give back a buffer from `reserveReqBuf` without sending it. The driver is the
+ * only producer on the request free rings, so the buffer is kept on the server
+ * side and handed out again by the next `reserveReqBuf` of its size class.
+ * @return 0 on success, -1 on failure
+*/
+int abortReqBuf(int bus, uint8_t *ptr);
+
+/**
+ * Batched version of `allocReqBuf`. Allocates and loads up to `count` requests
+ * and publishes them all to the driver with a single ring update.
+ *
+ * @param bus: EE domain i2c master interface number
+ * @param count: Number of entries in reqs. Max I2C_BATCH_MAX
+ * @param reqs: Requests to load
+ * @return Number of requests queued. Requests are queued in order, so a short
+ *         count means reqs[ret] onwards were not queued.
 */
-req_buf_ptr_t allocReqBuf(int bus, size_t size, uint8_t *data, uint8_t client, uint8_t addr);
+int allocReqBufs(int bus, int count, const i2c_req_t *reqs);
 
 /**
  * Release a request buffer to the free pool.
@@ -85,15 +180,14 @@ int releaseReqBuf(int bus, req_buf_ptr_t buf);
  * into the used queue by this function, unlike `allocReqBuf`.
  * Address and client are used to demultiplex by the server.
  * 
- * Buffers are allocated from the free pool, but are not put into the used pool.
- * 
- * @note Expects that data is properly formatted with END token terminator.
+ * Buffers are allocated from the free pool of the smallest size class that fits,
+ * but are not put into the used pool.
  * 
  * @param bus: EE domain i2c master interface number
-
+ * @param size: Number of bytes the buffer must hold, including the header. Max I2C_BUF_SZ
  * @return Pointer to the buffer allocated for this request
 */
-ret_buf_ptr_t getRetBuf(int bus);
+ret_buf_ptr_t getRetBuf(int bus, size_t size);
 
 
 /**
@@ -120,6 +214,14 @@ int pushRetBuf(int bus, ret_buf_ptr_t buf, size_t size);
 */
 req_buf_ptr_t popReqBuf(int bus, size_t *size);
 
+/**
+ * Batched version of `popReqBuf`. Pops up to `max` requests from the server
+ * with a single ring update. Requests that were sent inline are copied into
+ * buffers owned by the transport, which `releaseReqBuf` takes back as usual.
+ * @return Number of buffers popped into bufs/sizes.
+*/
+int popReqBufs(int bus, req_buf_ptr_t *bufs, size_t *sizes, int max);
+
 
 /**
  * Pop a return buffer from the driver to be returned to the clients.
@@ -128,13 +230,79 @@ req_buf_ptr_t popReqBuf(int bus, size_t *size);
 */
 ret_buf_ptr_t popRetBuf(int bus, size_t *size);
 
+/**
+ * Check whether a bus is part of the transport.
+ * @return nonzero if `bus` exists and has rings, 0 otherwise.
+*/
+int i2cBusEnabled(int bus);
+
+/**
+ * Whether `bus` has a non-zero ring depth configured at build time. Unlike
+ * i2cBusEnabled this does not need i2c_rings, so PDs without the rings mapped
+ * can use it.
+*/
+int i2cBusConfigured(int bus);
+
+/**
+ * Check whether there is anything to pop from the return/request rings of `bus`.
+ * Buses that are not in the transport are always empty.
+*/
 int retBufEmpty(int bus);
 int reqBufEmpty(int bus);
 
+/**
+ * Notification suppression. The consumer of a used ring asks to be notified
+ * before it goes idle, and the producer only notifies after publishing if that
+ * request is outstanding. This way notifications are only sent on the
+ * idle-to-busy transition of the other side.
+ */
+
+/**
+ * Server side: call after queueing requests on `bus`.
+ * @return nonzero if the driver is idle on this bus and must be notified.
+*/
+int reqBufNeedsNotify(int bus);
+
+/**
+ * Driver side: call after pushing return buffers on `bus`.
+ * @return nonzero if the server is idle and must be notified.
+*/
+int retBufNeedsNotify(int bus);
+
+/**
+ * Driver side: ask the server to notify on the next request queued on `bus`.
+ * @return nonzero if there is still no work and the driver may go idle on this
+ *         bus, 0 if a request arrived in the meantime.
+*/
+int reqBufRequestNotify(int bus);
+
+/**
+ * Server side: ask the driver to notify on the next return pushed on `bus`.
+ * @return nonzero if there is still nothing to return and the server may go
+ *         idle on this bus, 0 if a return arrived in the meantime.
+*/
+int retBufRequestNotify(int bus);
+
+/**
+ * Driver side: call when there is no return buffer of at least `size` bytes
+ * on `bus`, to have the server notify once it releases one.
+ * @return nonzero if there is still none and the driver may wait for the
+ *         notification, 0 if one was released in the meantime.
+*/
+int retBufRequestFree(int bus, size_t size);
+
+/**
+ * Server side: call after releasing return buffers on `bus`.
+ * @return nonzero if the driver is waiting on them and must be notified.
+*/
+int retBufFreeNeedsNotify(int bus);
+
 
 // Errors
 #define I2C_ERR_OK 0
 #define I2C_ERR_TIMEOUT 1
 #define I2C_ERR_NACK 2
 #define I2C_ERR_NOREAD 3
+#define I2C_ERR_BADPROG 4
+#define I2C_ERR_MALFORMED 5
 #endif
\ No newline at end of file
@@ -17,10 +17,15 @@
 
 #define DRIVER_NOTIFY_ID 1  // Matching i2c.system
 
+// Built with I2C_DRIVER_PER_BUS, each bus has a driver PD of its own, with its
+// own channel to the server.
+#define DRIVER_BUS_NOTIFY_ID(bus) (4 + (bus))   // Matching i2c_per_bus.system
+
 // PPC idenitifers
-#define I2C_PPC_REQTYPE 1
-#define I2C_PPC_CLAIM 1
-#define I2C_PPC_RELEASE 2
+#define I2C_PPC_REQTYPE 0     // Message register holding the request type
+#define I2C_PPC_CLAIM 1       // MR1 = bus, MR2 = address, MR3 = device's max I2C_SPEED_*
+#define I2C_PPC_RELEASE 2     // MR1 = bus, MR2 = address
+#define I2C_PPC_PROG_RUN 3    // MR1 = bus, MR2 = program ID. Caller must hold the program's address.
 
 // Security
 #define I2C_SECURITY_LIST_SZ 127    // Supports one entry for each device
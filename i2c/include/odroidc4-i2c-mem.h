@@ -29,8 +29,8 @@
 #define REG_CTRL_ACK_IGNORE	BIT(1)
 #define REG_CTRL_STATUS		BIT(2)
 #define REG_CTRL_ERROR		BIT(3)
-#define REG_CTRL_CURR_TK    BIT(4) | BIT(5) | BIT(6) | BIT(7)
-#define REG_CTRL_RD_CNT     BIT(8) | BIT(9) | BIT(10) | BIT(11)
+#define REG_CTRL_CURR_TK    (BIT(4) | BIT(5) | BIT(6) | BIT(7))
+#define REG_CTRL_RD_CNT     (BIT(8) | BIT(9) | BIT(10) | BIT(11))
 #define REG_CTRL_MANUAL     BIT(22)
 #define REG_CTRL_MAN_S_SCL  BIT(23)
 #define REG_CTRL_MAN_S_SDA  BIT(24)
@@ -39,13 +39,20 @@
 #define REG_CTRL_CNTL_JIC   BIT(31)
 #define REG_CTRL_CLKDIV_SHIFT	12
 #define REG_CTRL_CLKDIV_MASK	((BIT(10) - 1) << REG_CTRL_CLKDIV_SHIFT)
+#define REG_CTRL_CLKDIVEXT_SHIFT 28     // Top two bits of the 12-bit divider
+#define REG_CTRL_CLKDIVEXT_MASK  (BIT(28) | BIT(29))
 
 // Addr register fields
 #define REG_ADDR_SCLDELAY_SHFT 16
+#define REG_ADDR_SCLDELAY_MASK  ((BIT(12) - 1) << REG_ADDR_SCLDELAY_SHFT)
 #define REG_ADDR_SDAFILTER    BIT(8) | BIT(9) | BIT(10)
 #define REG_ADDR_SCLFILTER    BIT(11) | BIT(12) | BIT(13)
 #define REG_ADDR_SCLDELAY_ENABLE BIT(28)
 
+// Clocking
+#define I2C_CLK81_RATE      166666666   // Rate of clk81, which feeds every master
+#define I2C_FILTER_DELAY    15          // clk81 cycles the input filter adds to the high period
+
 #define OC4_I2C_TK_END      (0x0)     // END: Terminator for token list, has no meaning to hardware otherwise
 #define OC4_I2C_TK_START    (0x1)     // START: Begin an i2c transfer. Causes master device to capture bus.
 #define OC4_I2C_TK_ADDRW    (0x2)     // ADDRESS WRITE: Used to wake up the target device on the bus. Sets up
@@ -62,6 +69,10 @@
 #define IRQ_I2C_M2_TO 3
 #define IRQ_I2C_M3 4
 #define IRQ_I2C_M3_TO 5
+#define IRQ_I2C_M0 6
+#define IRQ_I2C_M0_TO 7           // Reserved: not mapped until the hardware IRQ number is confirmed
+#define IRQ_I2C_M1 8
+#define IRQ_I2C_M1_TO 9           // Reserved: not mapped until the hardware IRQ number is confirmed
 
 
 #endif
\ No newline at end of file
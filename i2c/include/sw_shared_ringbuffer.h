@@ -12,23 +12,81 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 #include <sel4cp.h>
 #include "fence.h"
 
-#define SIZE 512
+// Default ring depth. Each ring's actual capacity is chosen at ring_init time.
+#define RING_DEFAULT_SIZE 512
 
-/* Buffer descriptor */
+// Cache line size of the Cortex-A55 cores on the S905X3. Anything written by
+// one side of a ring must not share a line with anything written by the other.
+#define RING_CACHE_LINE 64
+
+/*
+ * Buffer descriptor. Buffers are identified by their offset into the data
+ * region shared by both sides rather than by address, so each side can map
+ * that region wherever it likes and descriptors stay 8 bytes.
+ */
 typedef struct buff_desc {
-    uintptr_t encoded_addr; // Buffer address
-    unsigned int len; /* associated memory lengths */
+    uint32_t offset;    // Buffer offset into the shared data region
+    uint16_t len;       // Associated memory length
+    uint16_t flags;     // RING_DESC_* flags
 } buff_desc_t;
+_Static_assert(sizeof(buff_desc_t) == 8, "ring descriptors must stay 8 bytes");
+
+// Descriptor flags
+#define RING_DESC_INLINE 0x1    // Payload is held in the ring itself, see enqueue_inline
+
+// Largest payload an inline element can carry (three slots' worth)
+#define RING_INLINE_MAX (3 * sizeof(buff_desc_t))
+
+// dequeue found an inline element at the head, which it cannot hand out
+#define RING_ERR_INLINE (-2)
 
-/* Circular buffer containing descriptors */
+/*
+ * Circular buffer containing descriptors.
+ *
+ * Capacity is set per ring by ring_init and is always a power of two, so
+ * indices run freely and are reduced to a slot with `& mask`. A ring of
+ * capacity N holds N descriptors.
+ *
+ * The producer (enqueuer) owns the first cache line and the consumer (dequeuer)
+ * owns the second. Each side also keeps a shadow of the other side's index in
+ * its own line and only rereads the shared index when its shadow says the ring
+ * is full (producer) or empty (consumer). In steady state this means the index
+ * lines only move between cores when a side actually publishes something new.
+ *
+ * The last line holds the notification flag, which both sides write. The
+ * consumer raises it just before going idle and the producer only notifies
+ * (and clears it) when it sees it raised, so a busy consumer is never sent a
+ * notification it does not need.
+ */
 typedef struct ring_buffer {
+    // Read-only after initialisation
+    uint32_t size;
+    uint32_t mask;              // size - 1
+    uint8_t _pad_hdr[RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+
+    // Producer line
     uint32_t write_idx;
+    uint32_t read_idx_shadow;   // Producer's last observed read_idx
+    uint8_t _pad0[RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+
+    // Consumer line
     uint32_t read_idx;
-    buff_desc_t buffers[SIZE];
-} ring_buffer_t;
+    uint32_t write_idx_shadow;  // Consumer's last observed write_idx
+    uint8_t _pad1[RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+
+    // Shared line
+    uint32_t consumer_signal;   // Consumer is idle and must be notified on the next publish
+    uint8_t _pad2[RING_CACHE_LINE - sizeof(uint32_t)];
+
+    buff_desc_t buffers[];
+} __attribute__((aligned(RING_CACHE_LINE))) ring_buffer_t;
+
+// Bytes of shared memory needed for a ring of `size` descriptors
+#define RING_BUFFER_BYTES(size) (sizeof(ring_buffer_t) + (size) * sizeof(buff_desc_t))
 
 /* A ring handle for enqueing/dequeuing into  */
 typedef struct ring_handle {
@@ -42,13 +100,41 @@ typedef struct ring_handle {
  * @param ring ring handle to use.
  * @param free pointer to free ring in shared memory.
  * @param used pointer to 'used' ring in shared memory.
+ * @param size number of descriptors each ring holds. Rounded up to a power of two.
+ *             Only used when buffer_init is set - the other side picks the
+ *             capacity up from shared memory.
  * @param buffer_init 1 indicates the read and write indices in shared memory need to be initialised.
  *                    0 inidicates they do not. Only one side of the shared memory regions needs to do this.
  */
-void ring_init(ring_handle_t *ring, ring_buffer_t *free, ring_buffer_t *used, int buffer_init);
+void ring_init(ring_handle_t *ring, ring_buffer_t *free, ring_buffer_t *used, uint32_t size, int buffer_init);
+
+/**
+ * Initialise the indices of a single ring in shared memory, for rings that are
+ * not part of a free/used pair.
+ *
+ * @param ring ring buffer to initialise.
+ * @param size number of descriptors the ring holds. Rounded up to a power of two.
+ * @param consumer_signal 1 if the consumer starts out wanting a signal, as
+ *                        used rings do. 0 for rings that are only polled.
+ */
+void ring_buffer_init(ring_buffer_t *ring, uint32_t size, int consumer_signal);
+
+/**
+ * Round a requested ring capacity up to the power of two ring_init will use.
+ */
+static inline uint32_t ring_roundup_size(uint32_t size)
+{
+    uint32_t n = 1;
+    while (n < size) {
+        n <<= 1;
+    }
+    return n;
+}
 
 /**
  * Check if the ring buffer is empty.
+ * Must only be called by the consumer of this ring, as it refreshes the
+ * consumer's shadow of write_idx.
  *
  * @param ring ring buffer to check.
  *
@@ -56,11 +142,21 @@ void ring_init(ring_handle_t *ring, ring_buffer_t *free, ring_buffer_t *used, in
  */
 static inline int ring_empty(ring_buffer_t *ring)
 {
-    return !((ring->write_idx - ring->read_idx) % SIZE);
+    if (ring->write_idx_shadow != ring->read_idx) {
+        return 0;
+    }
+
+    // Shadow says empty - go and look at the producer's line.
+    ring->write_idx_shadow = *(volatile uint32_t *)&ring->write_idx;
+    THREAD_MEMORY_ACQUIRE();
+
+    return ring->write_idx_shadow == ring->read_idx;
 }
 
 /**
  * Check if the ring buffer is full
+ * Must only be called by the producer of this ring, as it refreshes the
+ * producer's shadow of read_idx.
  *
  * @param ring ring buffer to check.
  *
@@ -68,12 +164,65 @@ static inline int ring_empty(ring_buffer_t *ring)
  */
 static inline int ring_full(ring_buffer_t *ring)
 {
-    return !((ring->write_idx - ring->read_idx + 1) % SIZE);
+    if (ring->write_idx - ring->read_idx_shadow != ring->size) {
+        return 0;
+    }
+
+    // Shadow says full - go and look at the consumer's line.
+    ring->read_idx_shadow = *(volatile uint32_t *)&ring->read_idx;
+    THREAD_MEMORY_ACQUIRE();
+
+    return ring->write_idx - ring->read_idx_shadow == ring->size;
 }
 
+/**
+ * Number of elements in the ring. Reads both shared indices, so this is not
+ * intended for use on the fast path.
+ */
 static inline int ring_size(ring_buffer_t *ring)
 {
-    return (ring->write_idx - ring->read_idx);
+    return (*(volatile uint32_t *)&ring->write_idx - *(volatile uint32_t *)&ring->read_idx);
+}
+
+
+/**
+ * Called by the consumer before it goes idle, to ask the producer for a
+ * notification on its next publish. Must be followed by a check that the ring
+ * is still empty, which this function does: if something was published in
+ * the meantime the request is withdrawn and the consumer should keep going.
+ *
+ * @param ring ring buffer the consumer is about to stop servicing.
+ *
+ * @return 1 if the ring is empty and the consumer may go idle, 0 otherwise.
+ */
+static inline int ring_request_signal(ring_buffer_t *ring)
+{
+    *(volatile uint32_t *)&ring->consumer_signal = 1;
+    THREAD_MEMORY_FENCE();
+    if (!ring_empty(ring)) {
+        *(volatile uint32_t *)&ring->consumer_signal = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Called by the producer after publishing to decide whether the consumer
+ * needs to be notified. Clears the consumer's request if it was set, so only
+ * the first publish after the consumer went idle results in a notification.
+ *
+ * @param ring ring buffer that was just published to.
+ *
+ * @return 1 if the consumer must be notified, 0 otherwise.
+ */
+static inline int ring_require_signal(ring_buffer_t *ring)
+{
+    THREAD_MEMORY_FENCE();
+    if (*(volatile uint32_t *)&ring->consumer_signal) {
+        *(volatile uint32_t *)&ring->consumer_signal = 0;
+        return 1;
+    }
+    return 0;
 }
 
 
@@ -81,45 +230,55 @@ static inline int ring_size(ring_buffer_t *ring)
  * Enqueue an element to a ring buffer
  *
  * @param ring Ring buffer to enqueue into.
- * @param buffer address into shared memory where data is stored.
+ * @param offset offset into the shared data region where data is stored.
  * @param len length of data inside the buffer above.
  *
  * @return -1 when ring is empty, 0 on success.
  */
-static inline int enqueue(ring_buffer_t *ring, uintptr_t buffer, unsigned int len)
+static inline int enqueue(ring_buffer_t *ring, uint32_t offset, unsigned int len)
 {
     if (ring_full(ring)) {
         sel4cp_dbg_puts("Ring full");
         return -1;
     }
 
-    ring->buffers[ring->write_idx % SIZE].encoded_addr = buffer;
-    ring->buffers[ring->write_idx % SIZE].len = len;
-    ring->write_idx++;
+    buff_desc_t *desc = &ring->buffers[ring->write_idx & ring->mask];
+    desc->offset = offset;
+    desc->len = len;
+    desc->flags = 0;
 
+    // Descriptor must be visible before the index that publishes it
     THREAD_MEMORY_RELEASE();
+    ring->write_idx++;
 
     return 0;
 }
 
 /**
  * Dequeue an element to a ring buffer.
+ * Inline elements are left in place - use ring_read_inline for rings that
+ * may carry them.
  *
  * @param ring Ring buffer to Dequeue from.
- * @param buffer pointer to the address of where to store buffer address.
+ * @param offset pointer to where to store the buffer's offset into the data region.
  * @param len pointer to variable to store length of data dequeueing.
  *
- * @return -1 when ring is empty, 0 on success.
+ * @return -1 when ring is empty, RING_ERR_INLINE if the head is an inline
+ *         element, 0 on success.
  */
-static inline int dequeue(ring_buffer_t *ring, uintptr_t *addr, unsigned int *len)
+static inline int dequeue(ring_buffer_t *ring, uint32_t *offset, unsigned int *len)
 {
     if (ring_empty(ring)) {
         //sel4cp_dbg_puts("Ring is empty");
         return -1;
     }
 
-    *addr = ring->buffers[ring->read_idx % SIZE].encoded_addr;
-    *len = ring->buffers[ring->read_idx % SIZE].len;
+    buff_desc_t *desc = &ring->buffers[ring->read_idx & ring->mask];
+    if (desc->flags & RING_DESC_INLINE) {
+        return RING_ERR_INLINE;
+    }
+    *offset = desc->offset;
+    *len = desc->len;
 
     THREAD_MEMORY_RELEASE();
     ring->read_idx++;
@@ -127,19 +286,240 @@ static inline int dequeue(ring_buffer_t *ring, uintptr_t *addr, unsigned int *le
     return 0;
 }
 
+/*
+ * Slot level access, for callers that need to write or read several
+ * descriptors and publish or retire them all at once. The producer claims
+ * space with ring_space, fills ring_produce_slot(ring, 0 .. n-1) and publishes
+ * with ring_produce. The consumer mirrors this with ring_avail,
+ * ring_consume_slot and ring_consume.
+ */
+
+/**
+ * Producer side: number of free slots, rereading the consumer's index only if
+ * the shadow says there are fewer than `want`.
+ */
+static inline uint32_t ring_space(ring_buffer_t *ring, uint32_t want)
+{
+    uint32_t space = ring->size - (ring->write_idx - ring->read_idx_shadow);
+    if (space < want) {
+        ring->read_idx_shadow = *(volatile uint32_t *)&ring->read_idx;
+        THREAD_MEMORY_ACQUIRE();
+        space = ring->size - (ring->write_idx - ring->read_idx_shadow);
+    }
+    return space;
+}
+
+static inline buff_desc_t *ring_produce_slot(ring_buffer_t *ring, uint32_t i)
+{
+    return &ring->buffers[(ring->write_idx + i) & ring->mask];
+}
+
+/**
+ * Producer side: publish n slots with a single barrier and index update.
+ */
+static inline void ring_produce(ring_buffer_t *ring, uint32_t n)
+{
+    THREAD_MEMORY_RELEASE();
+    ring->write_idx += n;
+}
+
+/**
+ * Consumer side: number of published slots, rereading the producer's index
+ * only if the shadow says there are fewer than `want`.
+ */
+static inline uint32_t ring_avail(ring_buffer_t *ring, uint32_t want)
+{
+    uint32_t avail = ring->write_idx_shadow - ring->read_idx;
+    if (avail < want) {
+        ring->write_idx_shadow = *(volatile uint32_t *)&ring->write_idx;
+        THREAD_MEMORY_ACQUIRE();
+        avail = ring->write_idx_shadow - ring->read_idx;
+    }
+    return avail;
+}
+
+static inline buff_desc_t *ring_consume_slot(ring_buffer_t *ring, uint32_t i)
+{
+    return &ring->buffers[(ring->read_idx + i) & ring->mask];
+}
+
+/**
+ * Consumer side: retire n slots with a single barrier and index update.
+ */
+static inline void ring_consume(ring_buffer_t *ring, uint32_t n)
+{
+    THREAD_MEMORY_RELEASE();
+    ring->read_idx += n;
+}
+
+/**
+ * Enqueue up to n elements to a ring buffer. All descriptors are published
+ * with a single barrier and index update.
+ *
+ * @param ring Ring buffer to enqueue into.
+ * @param offsets array of n buffer offsets into the data region.
+ * @param lens array of n buffer lengths.
+ * @param n number of elements to enqueue.
+ *
+ * @return number of elements enqueued, which is less than n if the ring filled.
+ */
+static inline unsigned int enqueue_batch(ring_buffer_t *ring, const uint32_t *offsets,
+                                         const unsigned int *lens, unsigned int n)
+{
+    uint32_t space = ring_space(ring, n);
+    if (space < n) {
+        n = space;
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        buff_desc_t *desc = ring_produce_slot(ring, i);
+        desc->offset = offsets[i];
+        desc->len = lens[i];
+        desc->flags = 0;
+    }
+
+    ring_produce(ring, n);
+
+    return n;
+}
+
+/**
+ * Dequeue up to n elements from a ring buffer, retiring them all with a
+ * single barrier and index update. Stops short of any inline element.
+ *
+ * @param ring Ring buffer to dequeue from.
+ * @param offsets array of at least n entries to store buffer offsets.
+ * @param lens array of at least n entries to store buffer lengths.
+ * @param n maximum number of elements to dequeue.
+ *
+ * @return number of elements dequeued, 0 if the ring was empty.
+ */
+static inline unsigned int dequeue_batch(ring_buffer_t *ring, uint32_t *offsets,
+                                         unsigned int *lens, unsigned int n)
+{
+    uint32_t avail = ring_avail(ring, n);
+    if (avail < n) {
+        n = avail;
+    }
+
+    unsigned int i;
+    for (i = 0; i < n; i++) {
+        buff_desc_t *desc = ring_consume_slot(ring, i);
+        if (desc->flags & RING_DESC_INLINE) {
+            break;
+        }
+        offsets[i] = desc->offset;
+        lens[i] = desc->len;
+    }
+
+    ring_consume(ring, i);
+
+    return i;
+}
+
+/*
+ * Inline elements carry a small payload in the ring itself instead of in the
+ * data region. The first slot is a header with RING_DESC_INLINE set, the
+ * payload length in len and a caller defined 32-bit tag in place of the
+ * offset. The payload follows in the next RING_INLINE_SLOTS(len) - 1 slots.
+ */
+
+/**
+ * Number of ring slots taken by an inline element with a payload of len bytes.
+ */
+#define RING_INLINE_SLOTS(len) (1 + ((len) + sizeof(buff_desc_t) - 1) / sizeof(buff_desc_t))
+
+/**
+ * Producer side: write an inline element starting at produce slot i. The
+ * caller must have claimed RING_INLINE_SLOTS(len) slots and publishes them.
+ *
+ * @return number of slots written.
+ */
+static inline uint32_t ring_write_inline(ring_buffer_t *ring, uint32_t i, uint32_t tag,
+                                         const void *data, unsigned int len)
+{
+    buff_desc_t *hdr = ring_produce_slot(ring, i);
+    hdr->offset = tag;
+    hdr->len = len;
+    hdr->flags = RING_DESC_INLINE;
+
+    const uint8_t *src = data;
+    uint32_t slots = RING_INLINE_SLOTS(len);
+    for (uint32_t s = 1; s < slots; s++) {
+        unsigned int chunk = len < sizeof(buff_desc_t) ? len : sizeof(buff_desc_t);
+        memcpy(ring_produce_slot(ring, i + s), src, chunk);
+        src += chunk;
+        len -= chunk;
+    }
+    return slots;
+}
+
+/**
+ * Consumer side: read the inline element starting at consume slot i, which
+ * must be an inline header. Lengths beyond RING_INLINE_MAX are clamped.
+ *
+ * @param data buffer of at least RING_INLINE_MAX bytes to receive the payload.
+ * @param len receives the payload length.
+ *
+ * @return number of slots the element occupies.
+ */
+static inline uint32_t ring_read_inline(ring_buffer_t *ring, uint32_t i, uint32_t *tag,
+                                        void *data, unsigned int *len)
+{
+    buff_desc_t *hdr = ring_consume_slot(ring, i);
+    unsigned int remaining = hdr->len > RING_INLINE_MAX ? RING_INLINE_MAX : hdr->len;
+    *tag = hdr->offset;
+    *len = remaining;
+
+    uint8_t *dst = data;
+    uint32_t slots = RING_INLINE_SLOTS(remaining);
+    for (uint32_t s = 1; s < slots; s++) {
+        unsigned int chunk = remaining < sizeof(buff_desc_t) ? remaining : sizeof(buff_desc_t);
+        memcpy(dst, ring_consume_slot(ring, i + s), chunk);
+        dst += chunk;
+        remaining -= chunk;
+    }
+    return slots;
+}
+
+/**
+ * Enqueue a single inline element.
+ *
+ * @param ring Ring buffer to enqueue into.
+ * @param tag caller defined value stored alongside the payload.
+ * @param data payload to copy into the ring.
+ * @param len length of payload. Max RING_INLINE_MAX.
+ *
+ * @return -1 when ring is full or payload too long, 0 on success.
+ */
+static inline int enqueue_inline(ring_buffer_t *ring, uint32_t tag, const void *data, unsigned int len)
+{
+    if (len > RING_INLINE_MAX) {
+        return -1;
+    }
+    uint32_t slots = RING_INLINE_SLOTS(len);
+    if (ring_space(ring, slots) < slots) {
+        sel4cp_dbg_puts("Ring full");
+        return -1;
+    }
+    ring_write_inline(ring, 0, tag, data, len);
+    ring_produce(ring, slots);
+    return 0;
+}
+
 /**
  * Enqueue an element into a free ring buffer.
  * This indicates the buffer address parameter is currently free for re-use.
  *
  * @param ring Ring handle to enqueue into.
- * @param buffer address into shared memory where data is stored.
+ * @param offset offset into the shared data region where data is stored.
  * @param len length of data inside the buffer above.
  *
  * @return -1 when ring is empty, 0 on success.
  */
-static inline int enqueue_free(ring_handle_t *ring, uintptr_t addr, unsigned int len)
+static inline int enqueue_free(ring_handle_t *ring, uint32_t offset, unsigned int len)
 {
-    return enqueue(ring->free_ring, addr, len);
+    return enqueue(ring->free_ring, offset, len);
 }
 
 /**
@@ -147,42 +527,83 @@ static inline int enqueue_free(ring_handle_t *ring, uintptr_t addr, unsigned int
  * This indicates the buffer address parameter is currently in use.
  *
  * @param ring Ring handle to enqueue into.
- * @param buffer address into shared memory where data is stored.
+ * @param offset offset into the shared data region where data is stored.
  * @param len length of data inside the buffer above.
  *
  * @return -1 when ring is empty, 0 on success.
  */
-static inline int enqueue_used(ring_handle_t *ring, uintptr_t addr, unsigned int len)
+static inline int enqueue_used(ring_handle_t *ring, uint32_t offset, unsigned int len)
 {
-    return enqueue(ring->used_ring, addr, len);
+    return enqueue(ring->used_ring, offset, len);
 }
 
 /**
  * Dequeue an element from the free ring buffer.
  *
  * @param ring Ring handle to dequeue from.
- * @param buffer pointer to the address of where to store buffer address.
+ * @param offset pointer to where to store the buffer's offset into the data region.
  * @param len pointer to variable to store length of data dequeueing.
  *
  * @return -1 when ring is empty, 0 on success.
  */
-static inline int dequeue_free(ring_handle_t *ring, uintptr_t *addr, unsigned int *len)
+static inline int dequeue_free(ring_handle_t *ring, uint32_t *offset, unsigned int *len)
 {
-    return dequeue(ring->free_ring, addr, len);
+    return dequeue(ring->free_ring, offset, len);
 }
 
 /**
  * Dequeue an element from a used ring buffer.
  *
  * @param ring Ring handle to dequeue from.
- * @param buffer pointer to the address of where to store buffer address.
+ * @param offset pointer to where to store the buffer's offset into the data region.
  * @param len pointer to variable to store length of data dequeueing.
  *
- * @return -1 when ring is empty, 0 on success.
+ * @return -1 when ring is empty, RING_ERR_INLINE if the head is an inline
+ *         element, 0 on success.
  */
-static inline int dequeue_used(ring_handle_t *ring, uintptr_t *addr, unsigned int *len)
+static inline int dequeue_used(ring_handle_t *ring, uint32_t *offset, unsigned int *len)
 {
-    return dequeue(ring->used_ring, addr, len);
+    return dequeue(ring->used_ring, offset, len);
+}
+
+/**
+ * Enqueue a batch of elements into a free ring buffer.
+ * @see enqueue_batch
+ */
+static inline unsigned int enqueue_free_batch(ring_handle_t *ring, const uint32_t *offsets,
+                                              const unsigned int *lens, unsigned int n)
+{
+    return enqueue_batch(ring->free_ring, offsets, lens, n);
+}
+
+/**
+ * Enqueue a batch of elements into a used ring buffer.
+ * @see enqueue_batch
+ */
+static inline unsigned int enqueue_used_batch(ring_handle_t *ring, const uint32_t *offsets,
+                                              const unsigned int *lens, unsigned int n)
+{
+    return enqueue_batch(ring->used_ring, offsets, lens, n);
+}
+
+/**
+ * Dequeue a batch of elements from a free ring buffer.
+ * @see dequeue_batch
+ */
+static inline unsigned int dequeue_free_batch(ring_handle_t *ring, uint32_t *offsets,
+                                              unsigned int *lens, unsigned int n)
+{
+    return dequeue_batch(ring->free_ring, offsets, lens, n);
+}
+
+/**
+ * Dequeue a batch of elements from a used ring buffer.
+ * @see dequeue_batch
+ */
+static inline unsigned int dequeue_used_batch(ring_handle_t *ring, uint32_t *offsets,
+                                              unsigned int *lens, unsigned int n)
+{
+    return dequeue_batch(ring->used_ring, offsets, lens, n);
 }
 
 /**
@@ -191,22 +612,13 @@ static inline int dequeue_used(ring_handle_t *ring, uintptr_t *addr, unsigned in
  * into this structure to be passed around as a cookie.
  *
  * @param ring Ring buffer to dequeue from.
- * @param addr pointer to the address of where to store buffer address.
+ * @param offset pointer to where to store the buffer's offset into the data region.
  * @param len pointer to variable to store length of data dequeueing.
  *
- * @return -1 when ring is empty, 0 on success.
+ * @return -1 when ring is empty, RING_ERR_INLINE if the head is an inline
+ *         element, 0 on success.
  */
-static int driver_dequeue(ring_buffer_t *ring, uintptr_t *addr, unsigned int *len)
+static int driver_dequeue(ring_buffer_t *ring, uint32_t *offset, unsigned int *len)
 {
-    if (!((ring->write_idx - ring->read_idx) % SIZE)) {
-        return -1;
-    }
-
-    *addr = ring->buffers[ring->read_idx % SIZE].encoded_addr;
-    *len = ring->buffers[ring->read_idx % SIZE].len;
-
-    THREAD_MEMORY_RELEASE();
-    ring->read_idx++;
-
-    return 0;
+    return dequeue(ring, offset, len);
 }
@@ -5,15 +5,26 @@
 
 #include "sw_shared_ringbuffer.h"
 
-void ring_init(ring_handle_t *ring, ring_buffer_t *free, ring_buffer_t *used, int buffer_init)
+void ring_buffer_init(ring_buffer_t *ring, uint32_t size, int consumer_signal)
+{
+    size = ring_roundup_size(size);
+    ring->size = size;
+    ring->mask = size - 1;
+    ring->write_idx = 0;
+    ring->read_idx = 0;
+    ring->read_idx_shadow = 0;
+    ring->write_idx_shadow = 0;
+    ring->consumer_signal = consumer_signal;
+}
+
+void ring_init(ring_handle_t *ring, ring_buffer_t *free, ring_buffer_t *used, uint32_t size, int buffer_init)
 {
     ring->free_ring = free;
     ring->used_ring = used;
 
     if (buffer_init) {
-        ring->free_ring->write_idx = 0;
-        ring->free_ring->read_idx = 0;
-        ring->used_ring->write_idx = 0;
-        ring->used_ring->read_idx = 0;
+        // Free rings are polled, never signalled. Consumers start out idle.
+        ring_buffer_init(free, size, 0);
+        ring_buffer_init(used, size, 1);
     }
 }